@@ -0,0 +1,574 @@
+/**
+ * @file asyncio.c
+ *
+ * @brief AsyncIo class that performs the file and socket reads and writes
+ * of the active objects without blocking their thread
+ *
+ * The io_uring is driven with its raw system calls, so that the project
+ * does not depend on liburing.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "util.h"
+#include "asyncio.h"
+
+
+/**
+ * @brief Kind of an operation
+ */
+typedef enum {
+    OP_READ,
+    OP_WRITE,
+    OP_CANCEL,  ///< Cancels the operation given as buf
+    OP_STOP     ///< Stops the completion thread
+} AsyncIoOp;
+
+/**
+ * @brief Operation in flight
+ */
+typedef struct asyncio_request_t {
+    struct asyncio_request_t * next; ///< Next operation of the fallback queue
+    struct asyncio_request_t * nextInFlight; ///< Next read or write in flight, for the cancellations
+    int cancelled;                   ///< Set by asyncIoCancel (fallback worker)
+    AsyncIoOp op;
+    int fd;
+    void * buf;
+    uint32_t len;
+    int64_t offset;
+    AsyncIoCallback callback;
+    void * caller;
+    void * userData;
+} AsyncIoRequest;
+
+/**
+ * @brief Submission and completion rings shared with the kernel
+ */
+typedef struct {
+    int fd;
+    void * sqRing;
+    size_t sqRingSize;
+    void * cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe * sqes;
+    size_t sqesSize;
+
+    unsigned * sqHead;
+    unsigned * sqTail;
+    unsigned * sqMask;
+    unsigned * sqArray;
+    unsigned * cqHead;
+    unsigned * cqTail;
+    unsigned * cqMask;
+    struct io_uring_cqe * cqes;
+} AsyncIoRing;
+
+struct asyncio_t {
+    int useRing;                ///< 1 if io_uring is used, 0 for the fallback worker
+    AsyncIoRing ring;
+
+    AsyncIoRequest * head;      ///< Fallback queue, in the order of submission
+    AsyncIoRequest * tail;
+    int wakeFd;                 ///< eventfd that wakes the fallback worker up when the queue changes
+
+    AsyncIoRequest * reads;     ///< Reads and writes in flight
+    uint32_t inFlight;          ///< Operations submitted and not completed
+    uint32_t maxInFlight;
+    pthread_mutex_t mutex;      ///< Protects the submissions, the fallback queue, the reads and inFlight
+    pthread_cond_t cond;        ///< Signaled when an operation completes
+    pthread_t threadId;         ///< Completion thread (or fallback worker)
+};
+
+
+static AsyncIo * defaultService = NULL;
+static pthread_once_t defaultOnce = PTHREAD_ONCE_INIT;
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static int asyncIoSetup(unsigned entries, struct io_uring_params * params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int asyncIoEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int asyncIoRegister(int fd, unsigned opcode, void * arg, unsigned nbArgs) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nbArgs);
+}
+
+/**
+ * @brief Checks that the kernel supports the read, write and cancel operations
+ *
+ * io_uring exists since Linux 5.1, but IORING_OP_READ and IORING_OP_WRITE
+ * only since 5.6, like the probe itself : an older kernel would fail every
+ * operation with -EINVAL.
+ *
+ * @retval -1 If the operations are not supported
+ */
+static int asyncIoRingProbe(int fd) {
+    unsigned nbOps = IORING_OP_WRITE + 1;
+    struct io_uring_probe * probe = calloc(1, sizeof(struct io_uring_probe) + nbOps * sizeof(struct io_uring_probe_op));
+    STOP_ON_ERROR(probe == NULL, "Error during memory allocation of the io_uring probe : ")
+
+    int supported = asyncIoRegister(fd, IORING_REGISTER_PROBE, probe, nbOps) == 0
+                    && probe->last_op >= IORING_OP_WRITE
+                    && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+                    && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+                    && (probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported ? 0 : -1;
+}
+
+/**
+ * @brief Creates the io_uring and maps its rings
+ *
+ * @retval -1 If io_uring is not available
+ */
+static int asyncIoRingInit(AsyncIoRing * ring, uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = asyncIoSetup(entries, &params);
+    if (ring->fd < 0) {
+        TRACE("[ASYNCIO] io_uring_setup failed (errno %d), using the fallback worker\n", errno)
+        return -1;
+    }
+    if (asyncIoRingProbe(ring->fd) != 0) {
+        TRACE("[ASYNCIO] io_uring cannot read nor write on this kernel, using the fallback worker\n")
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        TRACE("[ASYNCIO] io_uring mmap failed, using the fallback worker\n")
+        close(ring->fd);
+        return -1;
+    }
+
+    char * sq = ring->sqRing;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+
+    char * cq = ring->cqRing;
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void asyncIoRingClose(AsyncIoRing * ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+/**
+ * @brief Puts a request in the submission queue and submits it. Must be called with the mutex locked.
+ *
+ * @retval -1 If the kernel did not take the request : it is not in the ring anymore
+ */
+static int asyncIoRingSubmit(AsyncIoRing * ring, AsyncIoRequest * request) {
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe * sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (request->op == OP_READ) ? IORING_OP_READ
+                : (request->op == OP_WRITE) ? IORING_OP_WRITE
+                : (request->op == OP_CANCEL) ? IORING_OP_ASYNC_CANCEL
+                : IORING_OP_NOP;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t) (uintptr_t) request->buf; // OP_CANCEL : user_data of the cancelled request
+    sqe->len = request->len;
+    sqe->off = (uint64_t) request->offset; // -1 : current position of the file
+    sqe->user_data = (uint64_t) (uintptr_t) request;
+
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    int err;
+    do {
+        err = asyncIoEnter(ring->fd, 1, 0, 0);
+    } while (err < 0 && errno == EINTR);
+    ERROR(err < 0, "Error when submitting an operation to io_uring\n")
+
+    if (err <= 0 && __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == tail) {
+        // Not consumed : the entry is withdrawn before the caller frees the request
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a request from the fallback queue. Must be called with the mutex locked.
+ */
+static void asyncIoDequeue(AsyncIo * this, AsyncIoRequest * request) {
+    AsyncIoRequest ** link = &this->head;
+    AsyncIoRequest * previous = NULL;
+    while (*link != request) {
+        previous = *link;
+        link = &previous->next;
+    }
+    *link = request->next;
+    if (this->tail == request) {
+        this->tail = previous;
+    }
+}
+
+/**
+ * @brief Wakes the fallback worker up, so that it polls the new queue
+ */
+static void asyncIoWake(AsyncIo * this) {
+    uint64_t one = 1;
+    ssize_t err = write(this->wakeFd, &one, sizeof(one));
+    ERROR(err != sizeof(one), "Error when waking the I/O worker up\n")
+    (void) err;
+}
+
+/**
+ * @brief Calls the callback of a finished request and frees it
+ *
+ * @retval 1 If the request was the stop request
+ */
+static int asyncIoComplete(AsyncIo * this, AsyncIoRequest * request, int64_t result) {
+    int stop = (request->op == OP_STOP);
+    if (request->op == OP_READ || request->op == OP_WRITE) {
+        request->callback(request->caller, result, request->userData);
+    }
+
+    pthread_mutex_lock(&this->mutex);
+    // A cancellation may look for the request until it leaves the list
+    for (AsyncIoRequest ** link = &this->reads; *link != NULL; link = &(*link)->nextInFlight) {
+        if (*link == request) {
+            *link = request->nextInFlight;
+            break;
+        }
+    }
+    this->inFlight--;
+    pthread_cond_broadcast(&this->cond);
+    pthread_mutex_unlock(&this->mutex);
+
+    free(request);
+    return stop;
+}
+
+/**
+ * @brief Completion thread of the io_uring
+ */
+static void * asyncIoRingRun(AsyncIo * this) {
+    AsyncIoRing * ring = &this->ring;
+    int stop = 0;
+
+    while (!stop) {
+        int err = asyncIoEnter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (err < 0 && errno != EINTR) {
+            TRACE("ERROR : io_uring_enter failed while waiting for completions (exiting)\n");
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe * cqe = &ring->cqes[head & *ring->cqMask];
+            AsyncIoRequest * request = (AsyncIoRequest *) (uintptr_t) cqe->user_data;
+            int64_t result = cqe->res;
+            head++;
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE); // The kernel can reuse the entry
+
+            stop |= asyncIoComplete(this, request, result);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Performs a request of the fallback worker, once its file descriptor is ready
+ */
+static int64_t asyncIoPerform(AsyncIoRequest * request) {
+    ssize_t result = 0;
+    if (request->op == OP_READ) {
+        result = (request->offset < 0) ? read(request->fd, request->buf, request->len)
+                                       : pread(request->fd, request->buf, request->len, request->offset);
+    } else if (request->op == OP_WRITE) {
+        result = (request->offset < 0) ? write(request->fd, request->buf, request->len)
+                                       : pwrite(request->fd, request->buf, request->len, request->offset);
+    }
+    return (result < 0) ? -errno : result;
+}
+
+/**
+ * @brief Fallback worker : polls the file descriptors of the queue, and performs
+ * the operations whose file descriptor is ready
+ *
+ * An idle socket or pipe only holds its own operations. Only the first operation
+ * of each file descriptor is polled, so that they are performed in their order.
+ * The worker alone removes the requests from the queue : the cancelled ones are
+ * completed at the next turn.
+ */
+static void * asyncIoWorkerRun(AsyncIo * this) {
+    struct pollfd * fds = malloc((this->maxInFlight + 1) * sizeof(struct pollfd));
+    AsyncIoRequest ** polled = malloc(this->maxInFlight * sizeof(AsyncIoRequest *));
+    STOP_ON_ERROR(fds == NULL || polled == NULL, "Error during memory allocation of the I/O worker : ")
+    int stop = 0;
+
+    while (!stop) {
+        pthread_mutex_lock(&this->mutex);
+        AsyncIoRequest * request = this->head;
+        while (request != NULL && !request->cancelled && request->op != OP_STOP) {
+            request = request->next;
+        }
+        if (request != NULL) { // Cancelled, or the stop request queued once every other operation is over
+            asyncIoDequeue(this, request);
+            pthread_mutex_unlock(&this->mutex);
+            stop = asyncIoComplete(this, request, -ECANCELED);
+            continue;
+        }
+
+        nfds_t count = 0;
+        for (request = this->head; request != NULL; request = request->next) {
+            int first = 1;
+            for (nfds_t i = 0; i < count && first; i++) {
+                first = (polled[i]->fd != request->fd);
+            }
+            if (first) {
+                polled[count] = request;
+                fds[count + 1].fd = request->fd;
+                fds[count + 1].events = (request->op == OP_READ) ? POLLIN : POLLOUT;
+                fds[count + 1].revents = 0;
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&this->mutex);
+
+        fds[0].fd = this->wakeFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        if (poll(fds, count + 1, -1) < 0) {
+            STOP_ON_ERROR(errno != EINTR, "Error when polling the file descriptors of the I/O worker")
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t wakes;
+            ssize_t err = read(this->wakeFd, &wakes, sizeof(wakes));
+            (void) err;
+        }
+
+        for (nfds_t i = 0; i < count; i++) {
+            if (fds[i + 1].revents == 0) {
+                continue;
+            }
+            request = polled[i];
+            pthread_mutex_lock(&this->mutex);
+            int cancelled = request->cancelled;
+            if (!cancelled) {
+                asyncIoDequeue(this, request);
+            }
+            pthread_mutex_unlock(&this->mutex);
+            if (!cancelled) { // POLLNVAL, POLLERR : the operation fails with its errno
+                asyncIoComplete(this, request, asyncIoPerform(request));
+            }
+        }
+    }
+
+    free(fds);
+    free(polled);
+    return NULL;
+}
+
+static int asyncIoSubmit(AsyncIo * this, AsyncIoOp op, int fd, void * buf, uint32_t len, int64_t offset,
+                         AsyncIoCallback callback, void * caller, void * userData) {
+    AsyncIoRequest * request = (AsyncIoRequest *) malloc(sizeof(AsyncIoRequest));
+    STOP_ON_ERROR(request == NULL, "Error during memory allocation of an I/O request : ")
+    request->next = NULL;
+    request->nextInFlight = NULL;
+    request->cancelled = 0;
+    request->op = op;
+    request->fd = fd;
+    request->buf = buf;
+    request->len = len;
+    request->offset = offset;
+    request->callback = callback;
+    request->caller = caller;
+    request->userData = userData;
+
+    pthread_mutex_lock(&this->mutex);
+    // The completion queue must never overflow
+    while (this->inFlight >= this->maxInFlight) {
+        pthread_cond_wait(&this->cond, &this->mutex);
+    }
+    this->inFlight++;
+
+    int err = 0;
+    if (this->useRing) {
+        err = asyncIoRingSubmit(&this->ring, request);
+        if (err != 0) {
+            this->inFlight--;
+            free(request);
+        }
+    } else {
+        if (this->tail == NULL) {
+            this->head = request;
+        } else {
+            this->tail->next = request;
+        }
+        this->tail = request;
+        asyncIoWake(this);
+    }
+    if (err == 0 && (op == OP_READ || op == OP_WRITE)) {
+        request->nextInFlight = this->reads;
+        this->reads = request;
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return err;
+}
+
+static void asyncIoDefaultInit(void) {
+    defaultService = asyncIoNew(ASYNCIO_DEFAULT_ENTRIES);
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+AsyncIo * asyncIoNew(uint32_t entries) {
+    AsyncIo * this = (AsyncIo *) malloc(sizeof(AsyncIo));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the I/O service : ")
+
+    this->useRing = (asyncIoRingInit(&this->ring, entries) == 0);
+    this->head = NULL;
+    this->tail = NULL;
+    this->wakeFd = -1;
+    if (!this->useRing) {
+        this->wakeFd = eventfd(0, EFD_CLOEXEC);
+        STOP_ON_ERROR(this->wakeFd < 0, "Error when creating the eventfd of the I/O worker")
+    }
+    this->reads = NULL;
+    this->inFlight = 0;
+    this->maxInFlight = entries;
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->cond, NULL);
+
+    int err = pthread_create(&this->threadId, NULL,
+                             this->useRing ? (void *) asyncIoRingRun : (void *) asyncIoWorkerRun, this);
+    STOP_ON_ERROR(err != 0, "Error when creating the I/O completion thread")
+
+    return this;
+}
+
+
+AsyncIo * asyncIoDefault(void) {
+    pthread_once(&defaultOnce, &asyncIoDefaultInit);
+    return defaultService;
+}
+
+
+int asyncIoRead(AsyncIo * this, int fd, void * buf, uint32_t len, int64_t offset,
+                AsyncIoCallback callback, void * caller, void * userData) {
+    return asyncIoSubmit(this, OP_READ, fd, buf, len, offset, callback, caller, userData);
+}
+
+
+int asyncIoWrite(AsyncIo * this, int fd, const void * buf, uint32_t len, int64_t offset,
+                 AsyncIoCallback callback, void * caller, void * userData) {
+    return asyncIoSubmit(this, OP_WRITE, fd, (void *) buf, len, offset, callback, caller, userData);
+}
+
+
+int asyncIoCancel(AsyncIo * this, void * caller) {
+    int count = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    for (AsyncIoRequest * request = this->reads; request != NULL; request = request->nextInFlight) {
+        if (request->caller != caller || request->cancelled) {
+            continue;
+        }
+        request->cancelled = 1;
+        count++;
+        if (this->useRing) {
+            // The completion queue holds twice the entries : the cancellations do not wait for room
+            AsyncIoRequest * cancel = (AsyncIoRequest *) calloc(1, sizeof(AsyncIoRequest));
+            STOP_ON_ERROR(cancel == NULL, "Error during memory allocation of an I/O cancellation : ")
+            cancel->op = OP_CANCEL;
+            cancel->fd = -1;
+            cancel->buf = request;
+            this->inFlight++;
+            if (asyncIoRingSubmit(&this->ring, cancel) != 0) {
+                this->inFlight--;
+                free(cancel);
+            }
+        }
+    }
+    if (count > 0 && !this->useRing) {
+        asyncIoWake(this);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return count;
+}
+
+
+void asyncIoFree(AsyncIo * this) {
+    pthread_mutex_lock(&this->mutex);
+    while (this->inFlight > 0) {
+        pthread_cond_wait(&this->cond, &this->mutex);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    // The stop request is the last one : every other operation is already over
+    asyncIoSubmit(this, OP_STOP, -1, NULL, 0, 0, NULL, NULL, NULL);
+    int err = pthread_join(this->threadId, NULL);
+    STOP_ON_ERROR(err != 0, "Error when waiting for the I/O completion thread to end")
+
+    if (this->useRing) {
+        asyncIoRingClose(&this->ring);
+    } else {
+        close(this->wakeFd);
+    }
+    pthread_mutex_destroy(&this->mutex);
+    pthread_cond_destroy(&this->cond);
+    free(this);
+}
@@ -0,0 +1,218 @@
+/**
+ * @file budget.c
+ *
+ * @brief Budget class that detects the ACTIONs running longer than their
+ * execution budget
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <time.h>
+
+#include "util.h"
+#include "budget.h"
+
+
+struct budget_slot_t {
+    BudgetMonitor * monitor;
+    const char * name;
+
+    /* Written by the object thread, read by the monitor */
+    uint64_t start;         ///< Beginning of the ACTION running, 0 if none
+    uint64_t budget;
+    const char * state;
+    const char * action;
+    uint64_t reported;      ///< Beginning of the last ACTION reported by the monitor
+
+    /* Written by the object thread, read by budgetGetOverruns() */
+    uint64_t overruns;
+    const char * lastState;
+    const char * lastAction;
+
+    struct budget_slot_t * next;
+};
+
+struct budget_monitor_t {
+    BudgetSlot * slots;
+    BudgetReport report;
+    uint32_t period;
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t stopCond;
+    pthread_t thread;
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static uint64_t budgetNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static void budgetReport(BudgetMonitor * this, BudgetSlot * slot, const char * state, const char * action,
+                         uint64_t elapsed, uint64_t budget, int running) {
+    if (this->report != NULL) {
+        this->report(slot->name, state, action, elapsed, budget, running);
+    } else { // Also reported in release builds, unlike TRACE
+        fprintf(stderr, "[BUDGET] %s : %s / %s %s %lu us for a budget of %lu us\n", slot->name, state, action,
+                running ? "running since" : "took", (unsigned long) (elapsed / 1000), (unsigned long) (budget / 1000));
+    }
+}
+
+/**
+ * @brief Reports the ACTIONs running beyond their budget. Called with the mutex locked.
+ */
+static void budgetCheck(BudgetMonitor * this) {
+    uint64_t now = budgetNow();
+
+    for (BudgetSlot * slot = this->slots; slot != NULL; slot = slot->next) {
+        uint64_t start = __atomic_load_n(&slot->start, __ATOMIC_ACQUIRE);
+        uint64_t reported = __atomic_load_n(&slot->reported, __ATOMIC_RELAXED);
+        if (start == 0 || start == reported) {
+            continue;
+        }
+        uint64_t budget = __atomic_load_n(&slot->budget, __ATOMIC_RELAXED);
+        const char * state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+        const char * action = __atomic_load_n(&slot->action, __ATOMIC_RELAXED);
+        // The ACTION may have ended meanwhile : the next one has another start
+        if (now > start + budget && __atomic_load_n(&slot->start, __ATOMIC_ACQUIRE) == start
+            && __atomic_compare_exchange_n(&slot->reported, &reported, start, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            budgetReport(this, slot, state, action, now - start, budget, 1);
+        }
+    }
+}
+
+static void * budgetRun(void * arg) {
+    BudgetMonitor * this = arg;
+
+    pthread_mutex_lock(&this->mutex);
+    while (this->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += this->period / 1000;
+        deadline.tv_nsec += (long) (this->period % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&this->stopCond, &this->mutex, &deadline);
+        if (this->running) {
+            budgetCheck(this);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+BudgetMonitor * budgetMonitorNew(uint32_t period, BudgetReport report) {
+    BudgetMonitor * this = (BudgetMonitor *) calloc(1, sizeof(BudgetMonitor));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the budget monitor : ")
+    this->report = report;
+    this->period = period;
+    this->running = 1;
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->stopCond, NULL);
+
+    int err = pthread_create(&this->thread, NULL, &budgetRun, this);
+    STOP_ON_ERROR(err != 0, "Error when creating the budget monitor thread")
+    return this;
+}
+
+
+BudgetSlot * budgetSlotNew(BudgetMonitor * this, const char * name) {
+    BudgetSlot * slot = (BudgetSlot *) calloc(1, sizeof(BudgetSlot));
+    STOP_ON_ERROR(slot == NULL, "Error during memory allocation of a budget slot : ")
+    slot->monitor = this;
+    slot->name = name;
+
+    pthread_mutex_lock(&this->mutex);
+    slot->next = this->slots;
+    this->slots = slot;
+    pthread_mutex_unlock(&this->mutex);
+
+    return slot;
+}
+
+
+void budgetBegin(BudgetSlot * this, uint64_t budget, const char * state, const char * action) {
+    __atomic_store_n(&this->budget, budget, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->state, state, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->action, action, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->start, budgetNow(), __ATOMIC_RELEASE);
+}
+
+
+int budgetEnd(BudgetSlot * this) {
+    uint64_t start = this->start;
+    uint64_t elapsed = budgetNow() - start;
+    __atomic_store_n(&this->start, 0, __ATOMIC_RELEASE);
+
+    if (elapsed <= this->budget) {
+        return 0;
+    }
+    __atomic_store_n(&this->lastState, this->state, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->lastAction, this->action, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->overruns, 1, __ATOMIC_RELEASE);
+    // Reported once : either by the monitor while it was running, or here
+    uint64_t reported = __atomic_load_n(&this->reported, __ATOMIC_RELAXED);
+    if (reported != start && __atomic_compare_exchange_n(&this->reported, &reported, start, 0,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        budgetReport(this->monitor, this, this->state, this->action, elapsed, this->budget, 0);
+    }
+    return 1;
+}
+
+
+uint64_t budgetGetOverruns(BudgetSlot * this, const char ** state, const char ** action) {
+    uint64_t overruns = __atomic_load_n(&this->overruns, __ATOMIC_ACQUIRE);
+    if (state != NULL) {
+        *state = __atomic_load_n(&this->lastState, __ATOMIC_RELAXED);
+    }
+    if (action != NULL) {
+        *action = __atomic_load_n(&this->lastAction, __ATOMIC_RELAXED);
+    }
+    return overruns;
+}
+
+
+void budgetSlotFree(BudgetSlot * this) {
+    BudgetMonitor * monitor = this->monitor;
+
+    pthread_mutex_lock(&monitor->mutex);
+    for (BudgetSlot ** slot = &monitor->slots; *slot != NULL; slot = &(*slot)->next) {
+        if (*slot == this) {
+            *slot = this->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&monitor->mutex);
+
+    free(this);
+}
+
+
+void budgetMonitorFree(BudgetMonitor * this) {
+    pthread_mutex_lock(&this->mutex);
+    this->running = 0;
+    pthread_cond_signal(&this->stopCond);
+    pthread_mutex_unlock(&this->mutex);
+    pthread_join(this->thread, NULL);
+
+    pthread_mutex_destroy(&this->mutex);
+    pthread_cond_destroy(&this->stopCond);
+    free(this);
+}
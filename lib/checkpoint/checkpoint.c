@@ -0,0 +1,429 @@
+/**
+ * @file checkpoint.c
+ *
+ * @brief Checkpoint class that saves the STATE and the instance variables of
+ * the active objects in a memory-mapped file, to restart them warm
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "checkpoint.h"
+
+
+/**
+ * @def Magic number of the checkpoint files
+ */
+#define CHECKPOINT_MAGIC (0x43484B50) // "CHKP"
+
+/**
+ * @def Number of copies tried when the object modifies its variables during the snapshot
+ */
+#define MAX_RETRIES (4)
+
+/**
+ * @def Number of periods between two synchronous writes of the file to the disk
+ *
+ * The other periods only schedule the write back (MS_ASYNC).
+ */
+#define SYNC_PERIODS (10)
+
+/**
+ * @brief Beginning of the checkpoint file
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t slotSize;
+    uint32_t reserved;
+} CheckpointHeader;
+
+/**
+ * @brief Record of an object in the file, followed by its two slots
+ */
+typedef struct {
+    char name[CHECKPOINT_NAME_LENGTH]; ///< Empty if the record is free
+    uint32_t size[2];       ///< Size of the snapshot of each slot, 0 if the slot is empty
+    uint32_t active;        ///< Slot of the last snapshot, written last
+    uint32_t reserved;
+} CheckpointRecord;
+
+struct checkpoint_entry_t {
+    Checkpoint * checkpoint;
+    CheckpointRecord * record;
+    void * fields[CHECKPOINT_MAX_FIELDS];
+    uint32_t sizes[CHECKPOINT_MAX_FIELDS];
+    uint32_t nbFields;
+    uint32_t size;          ///< Total size of the fields
+    uint32_t seq;           ///< Odd while the object modifies its fields (seqlock)
+    uint32_t savedSeq;      ///< Value of seq at the last snapshot
+    int saved;              ///< A snapshot has been taken during this run
+    struct checkpoint_entry_t * next;
+};
+
+struct checkpoint_t {
+    char * file;            ///< Mapping of the file
+    size_t fileSize;
+    uint32_t capacity;
+    uint32_t slotSize;
+    uint32_t * index;       ///< Hash table of the names : record number + 1, 0 if empty
+    uint32_t indexMask;
+    uint32_t nextFree;      ///< The records before are used
+    CheckpointEntry * entries; ///< Registered objects
+    char * buffer;          ///< Copy of the fields of an object, used by the snapshots
+    pthread_mutex_t mutex;  ///< Protects the entries and the buffer
+    pthread_cond_t stopCond;
+    int running;
+    uint32_t period;
+    pthread_t thread;
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static size_t checkpointRecordSize(uint32_t slotSize) {
+    return sizeof(CheckpointRecord) + 2 * (size_t) slotSize;
+}
+
+static CheckpointRecord * checkpointRecordAt(Checkpoint * this, uint32_t index) {
+    return (CheckpointRecord *) (this->file + sizeof(CheckpointHeader) + index * checkpointRecordSize(this->slotSize));
+}
+
+/**
+ * @brief FNV-1a hash of a name
+ */
+static uint32_t checkpointHash(const char * name) {
+    uint32_t hash = 2166136261U;
+    for (int i = 0; i < CHECKPOINT_NAME_LENGTH && name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Returns the position of a name in the hash table : its record, or the empty place where it goes
+ */
+static uint32_t checkpointLookup(Checkpoint * this, const char * name) {
+    uint32_t position = checkpointHash(name) & this->indexMask;
+    while (this->index[position] != 0
+           && strncmp(checkpointRecordAt(this, this->index[position] - 1)->name, name, CHECKPOINT_NAME_LENGTH) != 0) {
+        position = (position + 1) & this->indexMask;
+    }
+    return position;
+}
+
+static char * checkpointSlotOf(Checkpoint * this, CheckpointRecord * record, uint32_t slot) {
+    return (char *) (record + 1) + slot * (size_t) this->slotSize;
+}
+
+/**
+ * @brief Copies the fields of the object into the buffer
+ *
+ * The copy is made again if the object modified its fields meanwhile.
+ *
+ * @retval -1 If the object kept modifying its fields : the snapshot is given up until the next period
+ */
+static int checkpointCopy(CheckpointEntry * entry, char * buffer, uint32_t * seq) {
+    for (int retry = 0; retry < MAX_RETRIES; retry++) {
+        uint32_t before = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        char * copy = buffer;
+        for (uint32_t i = 0; i < entry->nbFields; i++) {
+            memcpy(copy, entry->fields[i], entry->sizes[i]);
+            copy += entry->sizes[i];
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == before) {
+            *seq = before;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Writes a snapshot of the object in the slot not in use, then makes it the current one.
+ * Must be called with the mutex locked.
+ */
+static void checkpointSnapshot(Checkpoint * this, CheckpointEntry * entry) {
+    uint32_t seq;
+    if (entry->saved && __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) == entry->savedSeq) {
+        return; // Not modified since the last snapshot
+    }
+    if (checkpointCopy(entry, this->buffer, &seq) == -1) {
+        TRACE("[CHECKPOINT] %s is busy, snapshot postponed\n", entry->record->name)
+        return;
+    }
+
+    CheckpointRecord * record = entry->record;
+    uint32_t slot = 1 - record->active;
+    memcpy(checkpointSlotOf(this, record, slot), this->buffer, entry->size);
+    record->size[slot] = entry->size;
+    __atomic_store_n(&record->active, slot, __ATOMIC_RELEASE);
+
+    entry->savedSeq = seq;
+    entry->saved = 1;
+}
+
+static void * checkpointRun(void * arg) {
+    Checkpoint * this = arg;
+    uint32_t periods = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    while (this->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += this->period / 1000;
+        deadline.tv_nsec += (long) (this->period % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&this->stopCond, &this->mutex, &deadline);
+        if (!this->running) {
+            break;
+        }
+        for (CheckpointEntry * entry = this->entries; entry != NULL; entry = entry->next) {
+            checkpointSnapshot(this, entry);
+        }
+
+        // Bounds what a crash of the system loses. The objects can register meanwhile.
+        periods++;
+        pthread_mutex_unlock(&this->mutex);
+        msync(this->file, this->fileSize, (periods % SYNC_PERIODS == 0) ? MS_SYNC : MS_ASYNC);
+        pthread_mutex_lock(&this->mutex);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+Checkpoint * checkpointOpen(const char * path, uint32_t capacity, uint32_t slotSize) {
+    Checkpoint * this = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the checkpoint : ")
+    this->buffer = (char *) malloc(slotSize);
+    STOP_ON_ERROR(this->buffer == NULL, "Error during memory allocation of the checkpoint buffer : ")
+    this->capacity = capacity;
+    this->slotSize = slotSize;
+    this->fileSize = sizeof(CheckpointHeader) + capacity * checkpointRecordSize(slotSize);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    ERROR(fd == -1, "Error when opening the checkpoint file %s\n", path)
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        free(this->buffer);
+        free(this);
+        return NULL;
+    }
+    // A file of another geometry is resized, then cleared below as its header does not match
+    if ((size_t) info.st_size != this->fileSize && ftruncate(fd, this->fileSize) == -1) {
+        ERROR(1, "Error when sizing the checkpoint file %s\n", path)
+        close(fd);
+        free(this->buffer);
+        free(this);
+        return NULL;
+    }
+    this->file = mmap(NULL, this->fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->file == MAP_FAILED) {
+        ERROR(1, "Error when mapping the checkpoint file %s\n", path)
+        free(this->buffer);
+        free(this);
+        return NULL;
+    }
+
+    CheckpointHeader * header = (CheckpointHeader *) this->file;
+    if (header->magic != CHECKPOINT_MAGIC || header->capacity != capacity || header->slotSize != slotSize) {
+        memset(this->file, 0, this->fileSize);
+        header->capacity = capacity;
+        header->slotSize = slotSize;
+        header->magic = CHECKPOINT_MAGIC;
+    }
+
+    // Index of the objects saved by the previous runs, with at least twice as many places as records
+    this->indexMask = 1;
+    while (this->indexMask < 2 * capacity) {
+        this->indexMask <<= 1;
+    }
+    this->index = (uint32_t *) calloc(this->indexMask, sizeof(uint32_t));
+    STOP_ON_ERROR(this->index == NULL, "Error during memory allocation of the checkpoint index : ")
+    this->indexMask--;
+    this->nextFree = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        CheckpointRecord * record = checkpointRecordAt(this, i);
+        if (record->name[0] != '\0') {
+            this->index[checkpointLookup(this, record->name)] = i + 1;
+            this->nextFree = i + 1;
+        }
+    }
+
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->stopCond, NULL);
+    return this;
+}
+
+
+int checkpointStart(Checkpoint * this, uint32_t period) {
+    this->period = period;
+    this->running = 1;
+    int err = pthread_create(&this->thread, NULL, &checkpointRun, this);
+    ERROR(err != 0, "Error when creating the checkpoint thread\n")
+    if (err != 0) {
+        this->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+
+CheckpointEntry * checkpointRegister(Checkpoint * this, const char * name) {
+    CheckpointEntry * entry = (CheckpointEntry *) calloc(1, sizeof(CheckpointEntry));
+    STOP_ON_ERROR(entry == NULL, "Error during memory allocation of the checkpoint entry : ")
+    entry->checkpoint = this;
+
+    char key[CHECKPOINT_NAME_LENGTH];
+    snprintf(key, CHECKPOINT_NAME_LENGTH, "%s", name);
+
+    pthread_mutex_lock(&this->mutex);
+    uint32_t position = checkpointLookup(this, key);
+    if (this->index[position] != 0) {
+        entry->record = checkpointRecordAt(this, this->index[position] - 1);
+    } else if (this->nextFree < this->capacity) { // First run of this object
+        CheckpointRecord * record = checkpointRecordAt(this, this->nextFree);
+        memset(record, 0, checkpointRecordSize(this->slotSize));
+        memcpy(record->name, key, CHECKPOINT_NAME_LENGTH);
+        this->index[position] = ++this->nextFree;
+        entry->record = record;
+    }
+    if (entry->record != NULL) {
+        entry->next = this->entries;
+        this->entries = entry;
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    if (entry->record == NULL) {
+        ERROR(1, "The checkpoint file is full (%u objects)\n", this->capacity)
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+
+int checkpointAddField(CheckpointEntry * this, void * field, uint32_t size) {
+    if (this->nbFields == CHECKPOINT_MAX_FIELDS || this->size + size > this->checkpoint->slotSize) {
+        ERROR(1, "Too many variables registered by %s\n", this->record->name)
+        return -1;
+    }
+    pthread_mutex_lock(&this->checkpoint->mutex);
+    this->fields[this->nbFields] = field;
+    this->sizes[this->nbFields] = size;
+    this->nbFields++;
+    this->size += size;
+    this->saved = 0;
+    pthread_mutex_unlock(&this->checkpoint->mutex);
+    return 0;
+}
+
+
+int checkpointRestore(CheckpointEntry * this) {
+    CheckpointRecord * record = this->record;
+    uint32_t slot = __atomic_load_n(&record->active, __ATOMIC_ACQUIRE);
+    if (record->size[slot] != this->size || this->size == 0) {
+        return -1;
+    }
+
+    const char * snapshot = checkpointSlotOf(this->checkpoint, record, slot);
+    for (uint32_t i = 0; i < this->nbFields; i++) {
+        memcpy(this->fields[i], snapshot, this->sizes[i]);
+        snapshot += this->sizes[i];
+    }
+    TRACE("[CHECKPOINT] %s restored\n", record->name)
+    return 0;
+}
+
+
+void checkpointBeginWrite(CheckpointEntry * this) {
+    __atomic_store_n(&this->seq, this->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+void checkpointEndWrite(CheckpointEntry * this) {
+    __atomic_store_n(&this->seq, this->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+void checkpointSave(Checkpoint * this) {
+    pthread_mutex_lock(&this->mutex);
+    for (CheckpointEntry * entry = this->entries; entry != NULL; entry = entry->next) {
+        checkpointSnapshot(this, entry);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    msync(this->file, this->fileSize, MS_ASYNC);
+}
+
+
+void checkpointUnregister(CheckpointEntry * this) {
+    Checkpoint * checkpoint = this->checkpoint;
+
+    pthread_mutex_lock(&checkpoint->mutex);
+    checkpointSnapshot(checkpoint, this);
+    for (CheckpointEntry ** entry = &checkpoint->entries; *entry != NULL; entry = &(*entry)->next) {
+        if (*entry == this) {
+            *entry = this->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&checkpoint->mutex);
+
+    free(this);
+}
+
+
+void checkpointClose(Checkpoint * this) {
+    if (this->running) {
+        pthread_mutex_lock(&this->mutex);
+        this->running = 0;
+        pthread_cond_signal(&this->stopCond);
+        pthread_mutex_unlock(&this->mutex);
+        pthread_join(this->thread, NULL);
+    }
+    checkpointSave(this);
+    msync(this->file, this->fileSize, MS_SYNC);
+    munmap(this->file, this->fileSize);
+
+    CheckpointEntry * entry = this->entries;
+    while (entry != NULL) {
+        CheckpointEntry * next = entry->next;
+        free(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&this->mutex);
+    pthread_cond_destroy(&this->stopCond);
+    free(this->index);
+    free(this->buffer);
+    free(this);
+}
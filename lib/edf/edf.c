@@ -0,0 +1,365 @@
+/**
+ * @file edf.c
+ *
+ * @brief EdfScheduler class that runs active objects on a shared pool of
+ * worker threads, earliest deadline first
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <time.h>
+
+#include "util.h"
+#include "tracer.h"
+#include "edf.h"
+
+
+/**
+ * @def Initial size of the heaps, doubled when they are full
+ */
+#define HEAP_INITIAL_SIZE (16)
+
+/**
+ * @brief Message waiting in a task
+ */
+typedef struct edf_message_t {
+    uint64_t deadline;
+    uint64_t seq;           ///< Arrival order, to keep the FIFO order of the messages with the same deadline
+    struct edf_message_t * next; ///< Next free message
+    size_t size;
+    char msg[];
+} EdfMessage;
+
+struct edf_task_t {
+    EdfScheduler * scheduler;
+    EdfHandler handler;
+    void * caller;
+    const char * name;
+    EdfMessage ** messages; ///< Min-heap of the pending messages
+    uint32_t count;
+    uint32_t size;
+    int heapIndex;          ///< Place in the heap of the scheduler, -1 if the task is not ready
+    int running;            ///< A worker is handling a message of the task
+    int removed;
+    EdfStats stats;
+};
+
+struct edf_scheduler_t {
+    EdfTask ** ready;       ///< Min-heap of the tasks that have messages and are not running
+    uint32_t count;
+    uint32_t size;
+    uint64_t seq;
+    EdfMessage * freeMessages;
+    pthread_mutex_t mutex;
+    pthread_cond_t readyCond;   ///< A task became ready
+    pthread_cond_t idleCond;    ///< A task stopped running
+    int stopped;
+    int nbWorkers;
+    pthread_t * workers;
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static int edfBefore(const EdfMessage * a, const EdfMessage * b) {
+    return (a->deadline != b->deadline) ? (a->deadline < b->deadline) : (a->seq < b->seq);
+}
+
+/**
+ * @brief Returns the message of a task with the earliest deadline
+ */
+static EdfMessage * edfFirstMessage(const EdfTask * task) {
+    return task->messages[0];
+}
+
+static int edfTaskBefore(const EdfTask * a, const EdfTask * b) {
+    return edfBefore(edfFirstMessage(a), edfFirstMessage(b));
+}
+
+static void * edfGrow(void * heap, uint32_t * size, size_t itemSize) {
+    uint32_t newSize = (*size == 0) ? HEAP_INITIAL_SIZE : 2 * *size;
+    heap = realloc(heap, newSize * itemSize);
+    STOP_ON_ERROR(heap == NULL, "Error during memory allocation of an EDF heap : ")
+    *size = newSize;
+    return heap;
+}
+
+/*------------- Heap of the messages of a task -------------*/
+
+static void edfMessagePush(EdfTask * task, EdfMessage * message) {
+    if (task->count == task->size) {
+        task->messages = edfGrow(task->messages, &task->size, sizeof(EdfMessage *));
+    }
+    uint32_t i = task->count++;
+    while (i > 0 && edfBefore(message, task->messages[(i - 1) / 2])) {
+        task->messages[i] = task->messages[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    task->messages[i] = message;
+}
+
+static EdfMessage * edfMessagePop(EdfTask * task) {
+    EdfMessage * first = task->messages[0];
+    EdfMessage * last = task->messages[--task->count];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= task->count) {
+            break;
+        }
+        if (child + 1 < task->count && edfBefore(task->messages[child + 1], task->messages[child])) {
+            child++;
+        }
+        if (!edfBefore(task->messages[child], last)) {
+            break;
+        }
+        task->messages[i] = task->messages[child];
+        i = child;
+    }
+    if (task->count > 0) {
+        task->messages[i] = last;
+    }
+    return first;
+}
+
+/*------------- Heap of the ready tasks -------------*/
+
+static void edfReadySet(EdfScheduler * this, uint32_t i, EdfTask * task) {
+    this->ready[i] = task;
+    task->heapIndex = (int) i;
+}
+
+static void edfReadyUp(EdfScheduler * this, uint32_t i) {
+    EdfTask * task = this->ready[i];
+    while (i > 0 && edfTaskBefore(task, this->ready[(i - 1) / 2])) {
+        edfReadySet(this, i, this->ready[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    edfReadySet(this, i, task);
+}
+
+static void edfReadyDown(EdfScheduler * this, uint32_t i) {
+    EdfTask * task = this->ready[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= this->count) {
+            break;
+        }
+        if (child + 1 < this->count && edfTaskBefore(this->ready[child + 1], this->ready[child])) {
+            child++;
+        }
+        if (!edfTaskBefore(this->ready[child], task)) {
+            break;
+        }
+        edfReadySet(this, i, this->ready[child]);
+        i = child;
+    }
+    edfReadySet(this, i, task);
+}
+
+static void edfReadyPush(EdfScheduler * this, EdfTask * task) {
+    if (this->count == this->size) {
+        this->ready = edfGrow(this->ready, &this->size, sizeof(EdfTask *));
+    }
+    edfReadySet(this, this->count++, task);
+    edfReadyUp(this, this->count - 1);
+}
+
+/**
+ * @brief Removes a task from the heap of the ready tasks
+ */
+static void edfReadyRemove(EdfScheduler * this, EdfTask * task) {
+    uint32_t i = (uint32_t) task->heapIndex;
+    task->heapIndex = -1;
+    EdfTask * last = this->ready[--this->count];
+    if (i < this->count) {
+        edfReadySet(this, i, last);
+        edfReadyUp(this, i);
+        edfReadyDown(this, (uint32_t) last->heapIndex);
+    }
+}
+
+/*------------- Workers -------------*/
+
+static void * edfWorker(void * arg) {
+    EdfScheduler * this = arg;
+
+    pthread_mutex_lock(&this->mutex);
+    for (;;) {
+        while (this->count == 0 && !this->stopped) {
+            pthread_cond_wait(&this->readyCond, &this->mutex);
+        }
+        if (this->stopped) {
+            break;
+        }
+
+        // The task whose next message has the earliest deadline
+        EdfTask * task = this->ready[0];
+        edfReadyRemove(this, task);
+        EdfMessage * message = edfMessagePop(task);
+        task->running = 1;
+        pthread_mutex_unlock(&this->mutex);
+
+        uint64_t start = tracerNow();
+        task->handler(task->caller, message->msg, message->deadline);
+        tracerSlice("edf", task->name, start, "deadline", (int64_t) message->deadline);
+        uint64_t end = edfNow();
+
+        pthread_mutex_lock(&this->mutex);
+        task->stats.handled++;
+        if (message->deadline != EDF_NO_DEADLINE && end > message->deadline) {
+            task->stats.missed++;
+            if (end - message->deadline > task->stats.maxLateness) {
+                task->stats.maxLateness = end - message->deadline;
+            }
+            TRACE("[EDF] %s missed a deadline by %lu ns\n", task->name, (unsigned long) (end - message->deadline))
+        }
+        message->next = this->freeMessages;
+        this->freeMessages = message;
+
+        task->running = 0;
+        if (task->count > 0 && !task->removed) {
+            edfReadyPush(this, task);
+        }
+        pthread_cond_broadcast(&this->idleCond);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+uint64_t edfNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+
+uint64_t edfDeadlineIn(uint32_t delay) {
+    return edfNow() + (uint64_t) delay * 1000000ULL;
+}
+
+
+EdfScheduler * edfNew(int nbWorkers) {
+    STOP_ON_ERROR(nbWorkers <= 0, "Wrong number of EDF workers\n")
+
+    EdfScheduler * this = (EdfScheduler *) calloc(1, sizeof(EdfScheduler));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the EDF scheduler : ")
+    this->workers = (pthread_t *) malloc(nbWorkers * sizeof(pthread_t));
+    STOP_ON_ERROR(this->workers == NULL, "Error during memory allocation of the EDF workers : ")
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->readyCond, NULL);
+    pthread_cond_init(&this->idleCond, NULL);
+
+    for (this->nbWorkers = 0; this->nbWorkers < nbWorkers; this->nbWorkers++) {
+        int err = pthread_create(&this->workers[this->nbWorkers], NULL, &edfWorker, this);
+        STOP_ON_ERROR(err != 0, "Error when creating an EDF worker")
+    }
+    return this;
+}
+
+
+EdfTask * edfAddTask(EdfScheduler * this, EdfHandler handler, void * caller, const char * name) {
+    EdfTask * task = (EdfTask *) calloc(1, sizeof(EdfTask));
+    STOP_ON_ERROR(task == NULL, "Error during memory allocation of an EDF task : ")
+    task->scheduler = this;
+    task->handler = handler;
+    task->caller = caller;
+    task->name = name;
+    task->heapIndex = -1;
+    return task;
+}
+
+
+void edfPost(EdfTask * task, const void * msg, size_t size, uint64_t deadline) {
+    EdfScheduler * this = task->scheduler;
+
+    pthread_mutex_lock(&this->mutex);
+    EdfMessage * message = this->freeMessages;
+    if (message != NULL && message->size >= size) {
+        this->freeMessages = message->next;
+    } else { // The messages of the free list are all of the same size in the usual case
+        message = (EdfMessage *) malloc(sizeof(EdfMessage) + size);
+        STOP_ON_ERROR(message == NULL, "Error during memory allocation of an EDF message : ")
+        message->size = size;
+    }
+    memcpy(message->msg, msg, size);
+    message->deadline = deadline;
+    message->seq = this->seq++;
+
+    edfMessagePush(task, message);
+    if (task->heapIndex >= 0) { // The earliest deadline of the task may be earlier now
+        edfReadyUp(this, (uint32_t) task->heapIndex);
+    } else if (!task->running) {
+        edfReadyPush(this, task);
+        pthread_cond_signal(&this->readyCond);
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+
+void edfGetStats(EdfTask * task, EdfStats * stats) {
+    pthread_mutex_lock(&task->scheduler->mutex);
+    *stats = task->stats;
+    stats->pending = task->count;
+    pthread_mutex_unlock(&task->scheduler->mutex);
+}
+
+
+void edfRemoveTask(EdfTask * task) {
+    EdfScheduler * this = task->scheduler;
+
+    pthread_mutex_lock(&this->mutex);
+    task->removed = 1;
+    if (task->heapIndex >= 0) {
+        edfReadyRemove(this, task);
+    }
+    while (task->running) {
+        pthread_cond_wait(&this->idleCond, &this->mutex);
+    }
+    while (task->count > 0) {
+        EdfMessage * message = edfMessagePop(task);
+        message->next = this->freeMessages;
+        this->freeMessages = message;
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    TRACE("[EDF] %s removed : %lu messages handled, %lu deadlines missed\n", task->name,
+          (unsigned long) task->stats.handled, (unsigned long) task->stats.missed)
+    free(task->messages);
+    free(task);
+}
+
+
+void edfFree(EdfScheduler * this) {
+    pthread_mutex_lock(&this->mutex);
+    this->stopped = 1;
+    pthread_cond_broadcast(&this->readyCond);
+    pthread_mutex_unlock(&this->mutex);
+
+    for (int i = 0; i < this->nbWorkers; i++) {
+        pthread_join(this->workers[i], NULL);
+    }
+
+    while (this->freeMessages != NULL) {
+        EdfMessage * message = this->freeMessages;
+        this->freeMessages = message->next;
+        free(message);
+    }
+    pthread_mutex_destroy(&this->mutex);
+    pthread_cond_destroy(&this->readyCond);
+    pthread_cond_destroy(&this->idleCond);
+    free(this->ready);
+    free(this->workers);
+    free(this);
+}
@@ -0,0 +1,104 @@
+/**
+ * @file asyncio.h
+ *
+ * @brief AsyncIo class that performs the file and socket reads and writes
+ * of the active objects without blocking their thread
+ *
+ * The operations are submitted to an io_uring. A single completion thread
+ * reaps them and calls the callback of each operation, which must only send
+ * the matching event to the mailbox of the object : the result is then
+ * handled by its STATE machine, like any other event.
+ *
+ * When io_uring is not available (kernel older than 5.6, seccomp profile
+ * of a container), the operations are done by a worker thread instead, with the
+ * same API and the same callbacks. The worker polls the file descriptors, so that
+ * an idle socket or pipe does not hold the operations of the others.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <stdint.h>
+
+
+/**
+ * @def ASYNCIO_DEFAULT_ENTRIES
+ *
+ * Size of the submission queue of the default service
+ */
+#define ASYNCIO_DEFAULT_ENTRIES (64)
+
+/**
+ * The asynchronous I/O service structure
+ */
+typedef struct asyncio_t AsyncIo;
+
+/**
+ * @brief Function called when an operation is over
+ *
+ * @note It is called from the completion thread : it must only send an
+ * event to the mailbox of the caller.
+ * @param caller instance given when the operation was submitted
+ * @param result number of bytes read or written, or -errno
+ * @param userData value given when the operation was submitted
+ */
+typedef void (*AsyncIoCallback)(void * caller, int64_t result, void * userData);
+
+/**
+ * @brief Creates an asynchronous I/O service and its completion thread
+ *
+ * @param entries maximum number of operations in flight
+ */
+extern AsyncIo * asyncIoNew(uint32_t entries);
+
+/**
+ * @brief Returns the service shared by the whole process, created at the first call
+ */
+extern AsyncIo * asyncIoDefault(void);
+
+/**
+ * @brief Submits a read
+ *
+ * @note This function blocks only if too many operations are in flight
+ * @param buf buffer filled by the read. It must stay valid until the callback is called.
+ * @param offset offset in the file, -1 to read at the current position (sockets, pipes)
+ * @retval 0 If the read has been submitted
+ * @retval -1 If it could not be submitted
+ */
+extern int asyncIoRead(AsyncIo * this, int fd, void * buf, uint32_t len, int64_t offset,
+                       AsyncIoCallback callback, void * caller, void * userData);
+
+/**
+ * @brief Submits a write
+ *
+ * @note This function blocks only if too many operations are in flight
+ * @param buf data to write. It must stay valid until the callback is called.
+ * @param offset offset in the file, -1 to write at the current position (sockets, pipes)
+ * @retval 0 If the write has been submitted
+ * @retval -1 If it could not be submitted
+ */
+extern int asyncIoWrite(AsyncIo * this, int fd, const void * buf, uint32_t len, int64_t offset,
+                        AsyncIoCallback callback, void * caller, void * userData);
+
+/**
+ * @brief Cancels the reads and writes of a caller that are still in flight
+ *
+ * @note The callback of each one is still called, from the completion thread,
+ * with -ECANCELED, or with its result if it was already over
+ * @return the number of operations cancelled
+ */
+extern int asyncIoCancel(AsyncIo * this, void * caller);
+
+/**
+ * @brief Waits for the operations in flight, then destroys the service
+ */
+extern void asyncIoFree(AsyncIo * this);
+
+
+#endif //ASYNCIO_H
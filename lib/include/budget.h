@@ -0,0 +1,102 @@
+/**
+ * @file budget.h
+ *
+ * @brief Budget class that detects the ACTIONs running longer than their
+ * execution budget
+ *
+ * The run loop of an object marks the beginning and the end of each ACTION
+ * on its slot : it only reads the clock, and counts an overrun at the end
+ * of an ACTION that exceeded its budget. A single monitor thread looks at
+ * all the slots periodically, to report an ACTION as soon as it exceeds its
+ * budget, while it is still blocking the mailbox of its object.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+
+/**
+ * The monitor structure
+ */
+typedef struct budget_monitor_t BudgetMonitor;
+
+/**
+ * The structure of the ACTIONs of one object
+ */
+typedef struct budget_slot_t BudgetSlot;
+
+/**
+ * @brief Function called for each overrun
+ *
+ * @param name name of the object
+ * @param state STATE in which the ACTION started
+ * @param action name of the ACTION
+ * @param elapsed time spent in the ACTION, in nanoseconds
+ * @param budget budget of the ACTION, in nanoseconds
+ * @param running non zero if the ACTION is still running (report of the monitor)
+ */
+typedef void (*BudgetReport)(const char * name, const char * state, const char * action,
+                             uint64_t elapsed, uint64_t budget, int running);
+
+/**
+ * @brief Creates a monitor and starts its thread
+ *
+ * @param period delay between two looks at the slots, in milliseconds
+ * @param report function called for each overrun, NULL to print them on stderr
+ */
+extern BudgetMonitor * budgetMonitorNew(uint32_t period, BudgetReport report);
+
+/**
+ * @brief Adds the slot of an object to the monitor
+ *
+ * @param name name of the object in the reports
+ */
+extern BudgetSlot * budgetSlotNew(BudgetMonitor * this, const char * name);
+
+/**
+ * @brief Marks the beginning of an ACTION. Called by the object thread.
+ *
+ * @param budget maximum duration of the ACTION, in nanoseconds
+ * @param state name of the STATE of the transition
+ * @param action name of the ACTION of the transition
+ */
+extern void budgetBegin(BudgetSlot * this, uint64_t budget, const char * state, const char * action);
+
+/**
+ * @brief Marks the end of the ACTION. Called by the object thread.
+ *
+ * @retval 1 If the ACTION exceeded its budget
+ * @retval 0 Otherwise
+ */
+extern int budgetEnd(BudgetSlot * this);
+
+/**
+ * @brief Returns the number of ACTIONs of the object that exceeded their budget
+ *
+ * @param[out] state STATE of the last overrun, or NULL if none. Can be NULL.
+ * @param[out] action ACTION of the last overrun, or NULL if none. Can be NULL.
+ */
+extern uint64_t budgetGetOverruns(BudgetSlot * this, const char ** state, const char ** action);
+
+/**
+ * @brief Removes the slot from the monitor
+ */
+extern void budgetSlotFree(BudgetSlot * this);
+
+/**
+ * @brief Stops the monitor thread and destroys the monitor
+ *
+ * @note The slots must be freed before
+ */
+extern void budgetMonitorFree(BudgetMonitor * this);
+
+
+#endif //BUDGET_H
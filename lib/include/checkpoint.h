@@ -0,0 +1,128 @@
+/**
+ * @file checkpoint.h
+ *
+ * @brief Checkpoint class that saves the STATE and the instance variables of
+ * the active objects in a memory-mapped file, to restart them warm
+ *
+ * Each object registers the variables to save under its name. A snapshot
+ * thread copies them periodically into the file, while the objects keep
+ * running : the run loop only marks the moments it modifies them
+ * (checkpointBeginWrite() / checkpointEndWrite()), and a copy made during a
+ * modification is given up and made again at the next period.
+ *
+ * Each object has two slots in the file : a snapshot is written in the
+ * slot that is not in use, then becomes the current one. A crash during a
+ * snapshot leaves the previous one intact. The snapshot thread writes the
+ * file back to the disk at every period, and waits for the write every ten
+ * periods.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+
+/**
+ * @def CHECKPOINT_NAME_LENGTH
+ *
+ * The maximum length of the name of an object, including the null terminal character
+ */
+#define CHECKPOINT_NAME_LENGTH (32)
+
+/**
+ * @def CHECKPOINT_MAX_FIELDS
+ *
+ * The maximum number of variables registered by an object
+ */
+#define CHECKPOINT_MAX_FIELDS (8)
+
+/**
+ * The checkpoint file structure
+ */
+typedef struct checkpoint_t Checkpoint;
+
+/**
+ * The structure of the variables registered by one object
+ */
+typedef struct checkpoint_entry_t CheckpointEntry;
+
+/**
+ * @brief Opens a checkpoint file, or creates it if it does not exist
+ *
+ * @note A file created with another capacity or slot size is cleared
+ * @param capacity maximum number of objects in the file
+ * @param slotSize maximum size of the variables of an object, in bytes
+ * @retval NULL If the file could not be opened
+ */
+extern Checkpoint * checkpointOpen(const char * path, uint32_t capacity, uint32_t slotSize);
+
+/**
+ * @brief Starts the snapshot thread
+ *
+ * @param period delay between two snapshots, in milliseconds
+ */
+extern int checkpointStart(Checkpoint * this, uint32_t period);
+
+/**
+ * @brief Registers an object, whose variables are then added with checkpointAddField()
+ *
+ * @param name unique name of the object, the same from one run to the other
+ * @retval NULL If the file is full
+ */
+extern CheckpointEntry * checkpointRegister(Checkpoint * this, const char * name);
+
+/**
+ * @brief Adds a variable to the snapshots of an object
+ *
+ * @retval 0 If the variable has been added
+ * @retval -1 If there are too many variables, or if they do not fit in a slot
+ */
+extern int checkpointAddField(CheckpointEntry * this, void * field, uint32_t size);
+
+/**
+ * @brief Copies the last snapshot of the object back into its variables
+ *
+ * @note Called once the variables are added, before the object is started
+ * @retval 0 If the variables have been restored
+ * @retval -1 If there is no snapshot of this object with these variables
+ */
+extern int checkpointRestore(CheckpointEntry * this);
+
+/**
+ * @brief Marks the beginning of a modification of the variables. Called by the object thread.
+ */
+extern void checkpointBeginWrite(CheckpointEntry * this);
+
+/**
+ * @brief Marks the end of a modification of the variables. Called by the object thread.
+ */
+extern void checkpointEndWrite(CheckpointEntry * this);
+
+/**
+ * @brief Takes a snapshot of every registered object now
+ */
+extern void checkpointSave(Checkpoint * this);
+
+/**
+ * @brief Takes a last snapshot of an object, then unregisters it
+ *
+ * @note Its last snapshot is kept in the file, for the next run
+ */
+extern void checkpointUnregister(CheckpointEntry * this);
+
+/**
+ * @brief Stops the snapshot thread, takes a last snapshot and closes the file
+ *
+ * @note The objects must be unregistered before
+ */
+extern void checkpointClose(Checkpoint * this);
+
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,85 @@
+/**
+ * @file coroutine.h
+ *
+ * @brief Macros for stackless coroutines, used to write long ACTIONs that
+ * give the hand back to the run loop of their active object
+ *
+ * An ACTION written as a coroutine runs until CO_YIELD(), returns, and is
+ * resumed after the CO_YIELD() the next time it is called. Between two
+ * calls, the run loop takes at most one EVENT from its mailbox : an
+ * interleavable EVENT that keeps the STATE (E_ASK, E_REPLY, E_IO_DONE) is
+ * handled at once, while E_SYNC, E_KILL and the other EVENTs are deferred
+ * until the ACTION is over, in their order.
+ *
+ * How to use :
+ * @code
+ * static void ActionLong(Example * this) {
+ *     CO_BEGIN(&this->co);
+ *     for (this->i = 0; this->i < N; this->i++) {
+ *         compute(this, this->i);
+ *         CO_YIELD(&this->co);
+ *     }
+ *     CO_END(&this->co);
+ * }
+ * @endcode
+ *
+ * @warning The local variables are lost at each CO_YIELD() : the values
+ * that must survive are stored in the object.
+ * @warning A switch statement cannot contain a CO_YIELD(), and a coroutine
+ * can only yield from its own body, not from a function it calls.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+
+/**
+ * @brief Resume point of a coroutine
+ */
+typedef struct {
+    int line; ///< Line of the last CO_YIELD, 0 if the coroutine is not running
+} Coroutine;
+
+/**
+ * @def CO_INIT
+ *
+ * @brief Initializes a coroutine : the next call starts from the beginning
+ */
+#define CO_INIT(co) do { (co)->line = 0; } while (0)
+
+/**
+ * @def CO_RUNNING
+ *
+ * @brief True if the coroutine yielded and has not reached CO_END() yet
+ */
+#define CO_RUNNING(co) ((co)->line != 0)
+
+/**
+ * @def CO_BEGIN
+ *
+ * @brief Starts the body of a coroutine, or jumps to its last CO_YIELD()
+ */
+#define CO_BEGIN(co) switch ((co)->line) { case 0:
+
+/**
+ * @def CO_YIELD
+ *
+ * @brief Returns from the coroutine. The next call resumes after this point.
+ */
+#define CO_YIELD(co) do { (co)->line = __LINE__; return; case __LINE__:; } while (0)
+
+/**
+ * @def CO_END
+ *
+ * @brief Ends the body of a coroutine : it is not running anymore
+ */
+#define CO_END(co) } (co)->line = 0
+
+
+#endif //COROUTINE_H
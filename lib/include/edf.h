@@ -0,0 +1,122 @@
+/**
+ * @file edf.h
+ *
+ * @brief EdfScheduler class that runs active objects on a shared pool of
+ * worker threads, earliest deadline first
+ *
+ * Each active object is a task with its own queue of messages. A message
+ * can carry an absolute deadline : the workers always handle the message
+ * with the earliest deadline among all the tasks, the messages without
+ * deadline coming last in their arrival order. A task is never run by two
+ * workers at the same time, so its messages are handled one after the other,
+ * as in the run loop of an active object.
+ *
+ * A message handled after its deadline is counted as a miss of its task.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef EDF_H
+#define EDF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**
+ * @def EDF_NO_DEADLINE
+ *
+ * Deadline of the messages that have none
+ */
+#define EDF_NO_DEADLINE (UINT64_MAX)
+
+/**
+ * The scheduler structure
+ */
+typedef struct edf_scheduler_t EdfScheduler;
+
+/**
+ * The structure of an active object run by the scheduler
+ */
+typedef struct edf_task_t EdfTask;
+
+/**
+ * @brief Function that handles a message of a task, called by a worker
+ *
+ * @param caller instance given to edfAddTask()
+ * @param msg the message, only valid during the call
+ * @param deadline the deadline of the message, EDF_NO_DEADLINE if none
+ */
+typedef void (*EdfHandler)(void * caller, void * msg, uint64_t deadline);
+
+/**
+ * @brief Statistics of a task
+ */
+typedef struct {
+    uint64_t handled;       ///< Messages handled
+    uint64_t missed;        ///< Messages handled after their deadline
+    uint64_t maxLateness;   ///< Worst delay after a deadline, in nanoseconds
+    uint32_t pending;       ///< Messages waiting
+} EdfStats;
+
+/**
+ * @brief Returns the current time of the scheduler clock (CLOCK_MONOTONIC), in nanoseconds
+ */
+extern uint64_t edfNow(void);
+
+/**
+ * @brief Returns the deadline that expires in delay milliseconds
+ */
+extern uint64_t edfDeadlineIn(uint32_t delay);
+
+/**
+ * @brief Creates a scheduler and starts its workers
+ *
+ * @param nbWorkers number of worker threads
+ */
+extern EdfScheduler * edfNew(int nbWorkers);
+
+/**
+ * @brief Adds an active object to the scheduler
+ *
+ * @param handler function that handles the messages of the object
+ * @param caller instance of the object
+ * @param name name of the object in the traces
+ */
+extern EdfTask * edfAddTask(EdfScheduler * this, EdfHandler handler, void * caller, const char * name);
+
+/**
+ * @brief Sends a message to a task
+ *
+ * @note This function never blocks : the message is copied
+ * @param deadline absolute deadline given by edfDeadlineIn() or edfNow(), EDF_NO_DEADLINE if none
+ */
+extern void edfPost(EdfTask * task, const void * msg, size_t size, uint64_t deadline);
+
+/**
+ * @brief Reads the statistics of a task
+ */
+extern void edfGetStats(EdfTask * task, EdfStats * stats);
+
+/**
+ * @brief Removes a task from the scheduler. Its pending messages are dropped.
+ *
+ * @note Waits until the message it is handling, if any, is over.
+ * Must not be called from the handler of the task.
+ */
+extern void edfRemoveTask(EdfTask * task);
+
+/**
+ * @brief Stops the workers and destroys the scheduler
+ *
+ * @note The tasks must be removed before. The messages being handled are
+ * finished, the other ones are dropped.
+ */
+extern void edfFree(EdfScheduler * this);
+
+
+#endif //EDF_H
@@ -0,0 +1,136 @@
+/**
+ * @file journal.h
+ *
+ * @brief Journal class that keeps the messages of a durable mailbox in
+ * memory-mapped files, so that they survive a crash of the process
+ *
+ * The messages are appended to a segment file mapped in memory. When the
+ * segment is full, the journal goes on in a new one (rotation), and the
+ * segments whose messages have all been acknowledged are deleted. The
+ * segments are written back to the disk by batches of msync().
+ *
+ * The consumer acknowledges the messages it has handled with a cumulative
+ * acknowledgement : after a restart, only the following messages are
+ * replayed.
+ *
+ * A journal kept with all its segments is also a record of the workload of
+ * a mailbox : journalReplayFile() replays it offline, at full speed or at
+ * its original pace, to measure the performance of a new version.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+
+/**
+ * @def JOURNAL_SEGMENT_SIZE
+ *
+ * Default size of a segment file, in bytes
+ */
+#define JOURNAL_SEGMENT_SIZE (1 << 20)
+
+/**
+ * @def JOURNAL_SYNC_BATCH
+ *
+ * Default number of messages appended between two msync()
+ */
+#define JOURNAL_SYNC_BATCH (64)
+
+/**
+ * @def JOURNAL_PATH_LENGTH
+ *
+ * Maximum length of the path of a journal, including the null terminal character.
+ * The names of its files add up to 15 characters to the path given to journalOpen().
+ */
+#define JOURNAL_PATH_LENGTH (256)
+
+/**
+ * The journal structure
+ */
+typedef struct journal_t Journal;
+
+/**
+ * @brief Function called for each replayed message
+ *
+ * @param caller instance given to the replay function
+ * @param seq number of the message in the journal
+ * @param data content of the message, only valid during the call
+ * @param length size of the message
+ */
+typedef void (*JournalCallback)(void * caller, uint64_t seq, const void * data, uint32_t length);
+
+/**
+ * @brief Opens a journal, or creates it if it does not exist
+ *
+ * The journal is made of the file <path>.meta and of the segment files
+ * <path>.<number>.seg
+ *
+ * @param path path of the journal, without extension
+ * @param segmentSize size of a segment file, usually JOURNAL_SEGMENT_SIZE
+ * @param syncBatch number of messages between two msync(), 0 to only write the
+ * segments back when they are rotated (the messages still survive a crash of the
+ * process, but not a crash of the system)
+ * @param keep non zero to keep the acknowledged segments, for journalReplayFile()
+ * @retval NULL If the journal could not be opened
+ */
+extern Journal * journalOpen(const char * path, uint32_t segmentSize, uint32_t syncBatch, int keep);
+
+/**
+ * @brief Appends a message at the end of the journal
+ *
+ * @return the number of the message, 0 if it could not be appended
+ */
+extern uint64_t journalAppend(Journal * this, const void * data, uint32_t length);
+
+/**
+ * @brief Acknowledges every message up to seq : they will not be replayed
+ */
+extern void journalAck(Journal * this, uint64_t seq);
+
+/**
+ * @brief Returns the number of the last acknowledged message
+ */
+extern uint64_t journalGetAcked(Journal * this);
+
+/**
+ * @brief Writes the appended messages back to the disk, without waiting for the batch
+ *
+ * @retval 0 If the messages are on the disk
+ * @retval -1 If msync() failed
+ */
+extern int journalSync(Journal * this);
+
+/**
+ * @brief Calls the callback for each message following afterSeq, in order
+ *
+ * @note Usually called with journalGetAcked() when the journal is opened,
+ * before any message is appended
+ * @return the number of replayed messages
+ */
+extern long journalReplay(Journal * this, uint64_t afterSeq, JournalCallback callback, void * caller);
+
+/**
+ * @brief Replays every message of a journal, acknowledged or not, without opening it
+ *
+ * @note The journal must have been opened with keep to contain its whole history
+ * @param speed 0 to replay at full speed, 1 to replay at the pace the messages
+ * were appended, 2 to replay twice as fast, and so on
+ * @return the number of replayed messages, -1 if the journal could not be read
+ */
+extern long journalReplayFile(const char * path, double speed, JournalCallback callback, void * caller);
+
+/**
+ * @brief Writes the journal back to the disk and closes it. Its files are kept.
+ */
+extern void journalClose(Journal * this);
+
+
+#endif //JOURNAL_H
@@ -42,37 +42,154 @@
  */
 #define MQ_MAX_MESSAGES (10)
 
+/**
+ * @def MAILBOX_MAX_EVENTS
+ *
+ * Number of EVENTs that can be selected by mailboxReceiveMatching().
+ * The messages of the following EVENTs are only received by mailboxReceive().
+ */
+#define MAILBOX_MAX_EVENTS (32)
+
+/**
+ * @def MAILBOX_EVENT_MASK
+ *
+ * Mask of one EVENT for mailboxReceiveMatching(). The masks are combined with |.
+ */
+#define MAILBOX_EVENT_MASK(event) (((event) >= 0 && (event) < MAILBOX_MAX_EVENTS) ? (1U << (event)) : 0U)
+
 
 #include <stdio.h>
 #include <pthread.h>
 #include <mqueue.h>
 
 #include "util.h"
+#include "journal.h"
+
+
+/**
+ * @def MAILBOX_URGENT_PRIORITY
+ *
+ * Priority of the urgent messages : they are received before the other
+ * messages of the queue
+ */
+#define MAILBOX_URGENT_PRIORITY (1)
+
+/**
+ * @def MAILBOX_POOL_MIN_PER_THREAD
+ *
+ * Minimum number of mailboxes created by each thread of mailboxPoolFill()
+ */
+#define MAILBOX_POOL_MIN_PER_THREAD (16)
 
+/**
+ * @def MAILBOX_SPILL_LIMIT
+ *
+ * Default hard cap of the messages kept in memory once the queue is full.
+ * A sender only blocks when the queue and the spill are both full.
+ */
+#define MAILBOX_SPILL_LIMIT (1024)
+
+/**
+ * @def MAILBOX_DEFER_LIMIT
+ *
+ * Maximum number of messages deferred by mailboxDefer() at the same time
+ */
+#define MAILBOX_DEFER_LIMIT (256)
+
+/**
+ * @def MAILBOX_CHUNK_SIZE
+ *
+ * Size in bytes of the segments of the spill
+ */
+#define MAILBOX_CHUNK_SIZE (4096)
+
+/**
+ * @def MAILBOX_CHUNK_POOL_SIZE
+ *
+ * Number of empty segments of each NUMA node kept for reuse by all the
+ * mailboxes. The other ones are given back to the system once the spill is drained.
+ */
+#define MAILBOX_CHUNK_POOL_SIZE (64)
 
 /**
  * The mailbox structure
  */
 typedef struct mailbox_t Mailbox;
 
+/**
+ * The structure of a pool of mailboxes created in advance
+ */
+typedef struct mailbox_pool_t MailboxPool;
+
 /**
  * @brief Initializes the queue
  */
 extern Mailbox * mailboxInit(char * objName, int objCounter, __syscall_slong_t maxMsgSize);
 
+/**
+ * @brief Initializes a durable queue, whose messages are kept in a journal
+ *
+ * The messages of the journal that have not been acknowledged by
+ * mailboxAck() before a crash or a stop are received first, in their
+ * original order, before the messages sent to the new queue.
+ *
+ * @note The stop EVENTs are not journaled
+ * @note The journal is closed by the caller, after mailboxClose()
+ * @param journal journal of the mailbox, opened with journalOpen()
+ */
+extern Mailbox * mailboxInitDurable(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal);
+
+/**
+ * @brief Initializes a queue whose memory is on a NUMA node, durable if journal is not NULL
+ *
+ * The mailbox structure and the segments of its spill are allocated on the
+ * node of the consumer thread. The messages of the queue itself are
+ * allocated by the kernel.
+ *
+ * @param journal journal of the mailbox, NULL for a usual mailbox
+ * @param node node of the consumer thread, NUMA_NO_NODE to not place the mailbox
+ */
+extern Mailbox * mailboxInitPlaced(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal,
+                                   int node);
+
 /**
  * @brief Destroys the queue
  */
 extern void mailboxClose(Mailbox * this);
 
+/**
+ * @brief Sets the hard cap of the spill of the queue
+ *
+ * The queue holds MQ_MAX_MESSAGES messages. Under a burst, the following
+ * messages are spilled in memory segments, received after the ones of the
+ * queue, and the segments are given back once drained. An idle mailbox only
+ * costs its queue.
+ *
+ * @note Must be called before the mailbox is used
+ * @param limit maximum number of spilled messages, 0 to only use the queue
+ */
+extern void mailboxSetSpillLimit(Mailbox * this, long limit);
+
 /**
  * @brief Sends a message to the queue
  *
- * @note This function is blocking if the queue is full
+ * @note This function is blocking if the queue and its spill are full
  * @param msg message
  */
 extern void mailboxSendMsg(Mailbox * this, char * msg);
 
+/**
+ * @brief Sends a message to the queue without ever blocking
+ *
+ * When the queue is full, the message is spilled even beyond the hard cap of
+ * the spill. Meant for the callbacks run by shared threads (I/O completions,
+ * replies, timeouts) : their messages are bounded by the requests in flight.
+ *
+ * @note The messages too big to be spilled still wait for room in the queue
+ * @param msg message
+ */
+extern void mailboxSendMsgUnbounded(Mailbox * this, char * msg);
+
 /**
  * @brief Sends a stop EVENT to the queue
  *
@@ -81,6 +198,18 @@ extern void mailboxSendMsg(Mailbox * this, char * msg);
  */
 extern void mailboxSendStop(Mailbox * this, char * msg);
 
+/**
+ * @brief Sends a stop EVENT to the queue, without waiting after a deadline
+ *
+ * @note The stop EVENT is the last message of the queue, unless it is urgent :
+ * it is then received before the messages already in the queue.
+ * @param urgent non zero to send the stop EVENT with MAILBOX_URGENT_PRIORITY
+ * @param deadline absolute CLOCK_REALTIME time after which the send is given up
+ * @retval 0 If the stop EVENT has been sent
+ * @retval -1 If the queue (or its spill, for a last stop EVENT) was still full at the deadline
+ */
+extern int mailboxTimedSendStop(Mailbox * this, char * msg, int urgent, const struct timespec * deadline);
+
 /**
  * @brief Receives a message from the queue
  *
@@ -89,5 +218,163 @@ extern void mailboxSendStop(Mailbox * this, char * msg);
  */
 extern void mailboxReceive(Mailbox * this, char * msg);
 
+/**
+ * @brief Receives a message from the queue if there is one
+ *
+ * @note This function never blocks. It makes no system call while the mailbox is empty.
+ * @param msg address of a message buffer
+ * @retval 0 If a message has been received
+ * @retval -1 If the queue is empty
+ */
+extern int mailboxTryReceive(Mailbox * this, char * msg);
+
+/**
+ * @brief Receives the oldest message whose EVENT is in the mask
+ *
+ * The messages of the other EVENTs are kept aside, in one FIFO per EVENT,
+ * and are received later by mailboxReceive() or mailboxReceiveMatching()
+ * in their arrival order.
+ *
+ * @note This function is blocking until a matching message arrives
+ * @note The EVENT must be the first field of the messages (see Msg in example.c)
+ * @note As mailboxReceive(), it must only be called by the consumer thread
+ * @param eventMask MAILBOX_EVENT_MASK() of the expected EVENTs
+ * @param msg address of a message buffer
+ */
+extern void mailboxReceiveMatching(Mailbox * this, uint32_t eventMask, char * msg);
+
+/**
+ * @brief Defers the last received message
+ *
+ * The message is kept in memory, outside of the queue, until mailboxRecall()
+ * is called. It is then received again at the place of its arrival order.
+ *
+ * @note Must only be called by the consumer thread, with the message it just received
+ * @param msg the last received message
+ * @retval 0 If the message has been deferred
+ * @retval -1 If MAILBOX_DEFER_LIMIT messages are already deferred : the message is not kept
+ */
+extern int mailboxDefer(Mailbox * this, char * msg);
+
+/**
+ * @brief Returns non zero if mailboxDefer() can keep another message
+ *
+ * @note A consumer that defers the messages it receives can stop receiving
+ * once it returns 0 : the following messages wait in the queue.
+ */
+extern int mailboxCanDefer(Mailbox * this);
+
+/**
+ * @brief Makes every deferred message receivable again, before the newer messages
+ *
+ * @note Must only be called by the consumer thread, usually when its STATE changes
+ */
+extern void mailboxRecall(Mailbox * this);
+
+/**
+ * @brief Returns the instance number given when the mailbox was created
+ *
+ * A mailbox taken from a pool keeps the number given by mailboxPoolFill().
+ */
+extern int mailboxGetCounter(Mailbox * this);
+
+/**
+ * @brief Returns the number of messages currently waiting in the queue,
+ * including the spilled ones and the ones kept aside by mailboxReceiveMatching()
+ *
+ * @retval -1 If the queue attributes could not be read
+ */
+extern long mailboxGetCount(Mailbox * this);
+
+/**
+ * @brief Enables the credit based flow control of the queue
+ *
+ * Each sent message consumes a credit, and the consumer gives it back with
+ * mailboxGrantCredits() once the message is handled. A producer that checks
+ * its credits (or uses mailboxTrySendMsg()) can slow down, batch or divert
+ * its messages before the queue is full.
+ *
+ * The messages already in the queue, such as the ones replayed from the
+ * journal, take their credits when the flow control is enabled.
+ *
+ * @param credits initial number of credits, usually MQ_MAX_MESSAGES
+ */
+extern void mailboxEnableCredits(Mailbox * this, int credits);
+
+/**
+ * @brief Returns the number of messages that can be sent without blocking
+ *
+ * @note Returns MQ_MAX_MESSAGES if the flow control is not enabled
+ */
+extern int mailboxGetCredits(Mailbox * this);
+
+/**
+ * @brief Gives credits back to the producers. Called by the consumer.
+ *
+ * @param credits number of messages handled since the last grant
+ */
+extern void mailboxGrantCredits(Mailbox * this, int credits);
+
+/**
+ * @brief Sends a message to the queue if a credit is available
+ *
+ * @note This function never blocks when the flow control is enabled
+ * @param msg message
+ * @retval 0 If the message has been sent
+ * @retval -1 If there is no credit left : the message has not been sent
+ */
+extern int mailboxTrySendMsg(Mailbox * this, char * msg);
+
+/**
+ * @brief Acknowledges the messages handled by the consumer, in a durable queue
+ *
+ * Every received message is considered handled, except the ones deferred or
+ * kept aside by mailboxReceiveMatching(). The acknowledged messages are not
+ * replayed after a restart.
+ *
+ * @note Must only be called by the consumer thread, after it handled a message.
+ * Does nothing if the queue is not durable.
+ */
+extern void mailboxAck(Mailbox * this);
+
+/**
+ * @brief Creates an empty pool of mailboxes
+ *
+ * The mailboxes are created by mailboxPoolFill() before they are needed
+ * (at startup, or while the application is idle), so that the objects
+ * created later only take one from the pool.
+ *
+ * @param objName name of the class of the objects, as in mailboxInit()
+ * @param maxMsgSize size of the messages, as in mailboxInit()
+ */
+extern MailboxPool * mailboxPoolNew(char * objName, __syscall_slong_t maxMsgSize);
+
+/**
+ * @brief Creates mailboxes in the pool, in parallel
+ *
+ * @note The counters must not be used by another mailbox of the same class
+ * @param firstCounter instance number of the first mailbox
+ * @param count number of mailboxes to create, numbered from firstCounter
+ */
+extern void mailboxPoolFill(MailboxPool * this, int firstCounter, int count);
+
+/**
+ * @brief Takes a mailbox from the pool
+ *
+ * @note The mailbox is destroyed by mailboxClose(), as the other ones
+ * @retval NULL If the pool is empty
+ */
+extern Mailbox * mailboxPoolTake(MailboxPool * this);
+
+/**
+ * @brief Returns the number of mailboxes available in the pool
+ */
+extern int mailboxPoolGetCount(MailboxPool * this);
+
+/**
+ * @brief Destroys the pool and the mailboxes that were not taken
+ */
+extern void mailboxPoolFree(MailboxPool * this);
+
 
 #endif //MAILBOX_H
\ No newline at end of file
@@ -0,0 +1,87 @@
+/**
+ * @file numa.h
+ *
+ * @brief NUMA functions that find the node of the CPUs and allocate memory
+ * on a given node
+ *
+ * The topology is read once from sysfs and the memory is placed with the
+ * mbind system call, so no NUMA library is needed. On a machine with a
+ * single node, the allocations are usual mallocs.
+ *
+ * @note The files that include this header must define _GNU_SOURCE, for cpu_set_t
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <sched.h>
+#include <stddef.h>
+
+
+/**
+ * @def NUMA_NO_NODE
+ *
+ * Node of the memory that is not placed
+ */
+#define NUMA_NO_NODE (-1)
+
+/**
+ * @def NUMA_MAX_NODES
+ *
+ * Maximum number of nodes handled
+ */
+#define NUMA_MAX_NODES (64)
+
+/**
+ * @def NUMA_HEADER_SIZE
+ *
+ * Bytes used by numaAlloc() before each allocation. A placed allocation
+ * takes whole pages : a size of a page minus this header fits in one page.
+ */
+#define NUMA_HEADER_SIZE (64)
+
+/**
+ * @brief Returns the number of nodes of the machine, 1 without NUMA
+ */
+extern int numaGetNodeCount(void);
+
+/**
+ * @brief Returns the node of a CPU, 0 if it is unknown
+ */
+extern int numaGetNodeOfCpu(int cpu);
+
+/**
+ * @brief Returns the node with the most CPUs of the set, NUMA_NO_NODE if the set is empty
+ */
+extern int numaGetNodeOfCpuSet(const cpu_set_t * cpus);
+
+/**
+ * @brief Returns the node of the CPU running the caller, NUMA_NO_NODE if it is unknown
+ */
+extern int numaGetCurrentNode(void);
+
+/**
+ * @brief Allocates memory on a node
+ *
+ * The node is preferred rather than required : when it is full, the memory
+ * comes from another node instead of failing.
+ *
+ * @param size size of the memory, in bytes
+ * @param node node of the memory, NUMA_NO_NODE for a usual malloc
+ * @return the memory, aligned on a cache line when placed
+ */
+extern void * numaAlloc(size_t size, int node);
+
+/**
+ * @brief Frees memory allocated by numaAlloc(). Does nothing if ptr is NULL.
+ */
+extern void numaFree(void * ptr);
+
+
+#endif //NUMA_H
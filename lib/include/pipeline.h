@@ -0,0 +1,120 @@
+/**
+ * @file pipeline.h
+ *
+ * @brief Pipeline class that chains processing stages, handing the message
+ * buffers from one stage to the next without copying them
+ *
+ * The messages are written in buffers taken from a pool of the pipeline.
+ * Each stage handles a buffer in place, then hands its address to the next
+ * stage through a single producer single consumer link. The last stage gives
+ * the buffer back to the pool.
+ *
+ * A stage runs on its own thread, unless it is fused with the previous stage :
+ * it is then called by the thread of the previous stage, right after it,
+ * which saves the handoff when it costs more than the work of the stage.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**
+ * @def PIPELINE_MAX_STAGES
+ *
+ * Maximum number of stages of a pipeline
+ */
+#define PIPELINE_MAX_STAGES (16)
+
+/**
+ * @def PIPELINE_FORWARD
+ *
+ * Returned by a stage to hand the buffer to the next stage
+ */
+#define PIPELINE_FORWARD (0)
+
+/**
+ * @def PIPELINE_RELEASE
+ *
+ * Returned by a stage to give the buffer back to the pool, without calling the next stages
+ */
+#define PIPELINE_RELEASE (1)
+
+/**
+ * The pipeline structure
+ */
+typedef struct pipeline_t Pipeline;
+
+/**
+ * @brief Function that handles a buffer in a stage
+ *
+ * @param caller instance given to pipelineAddStage()
+ * @param buffer the buffer, owned by the stage during the call
+ * @retval PIPELINE_FORWARD To hand the buffer to the next stage
+ * @retval PIPELINE_RELEASE To give the buffer back to the pool
+ */
+typedef int (*PipelineHandler)(void * caller, void * buffer);
+
+/**
+ * @brief Creates a pipeline and its pool of buffers
+ *
+ * @param bufferSize size of a buffer, in bytes
+ * @param nbBuffers number of buffers : maximum number of messages in the pipeline
+ */
+extern Pipeline * pipelineNew(size_t bufferSize, uint32_t nbBuffers);
+
+/**
+ * @brief Adds a stage at the end of the pipeline
+ *
+ * @note Must be called before pipelineStart()
+ * @param handler function that handles the buffers in the stage
+ * @param caller instance of the stage
+ * @param name name of the stage in the traces
+ * @param fused non zero to run the stage on the thread of the previous stage
+ */
+extern void pipelineAddStage(Pipeline * this, PipelineHandler handler, void * caller, const char * name, int fused);
+
+/**
+ * @brief Starts the threads of the stages
+ */
+extern void pipelineStart(Pipeline * this);
+
+/**
+ * @brief Takes a free buffer from the pool
+ *
+ * @note This function is blocking if all the buffers are in the pipeline
+ */
+extern void * pipelineAcquire(Pipeline * this);
+
+/**
+ * @brief Hands a buffer to the first stage. The caller does not own it anymore.
+ *
+ * @note The buffers must be pushed by a single thread
+ * @param buffer buffer given by pipelineAcquire()
+ */
+extern void pipelinePush(Pipeline * this, void * buffer);
+
+/**
+ * @brief Stops the pipeline once the pushed buffers have gone through all the stages
+ *
+ * @note Called by the thread that pushes the buffers
+ */
+extern void pipelineStop(Pipeline * this);
+
+/**
+ * @brief Destroys the pipeline and its buffers
+ *
+ * @note The pipeline must be stopped before, if it was started
+ */
+extern void pipelineFree(Pipeline * this);
+
+
+#endif //PIPELINE_H
@@ -0,0 +1,103 @@
+/**
+ * @file request.h
+ *
+ * @brief Request class that allows an active object to ask another one for
+ * a result without blocking its thread
+ *
+ * The caller opens a request, which gives a correlation id, and sends it
+ * with its table to the callee in a usual event. The callee answers with
+ * requestReply(). The reply (or the timeout of the request) is given to the
+ * callback of the caller, which must only send the matching event to the
+ * mailbox of the caller : the result is then handled by its STATE machine.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stdint.h>
+
+#include "util.h"
+
+
+/**
+ * @brief Status of a finished request
+ */
+ENUM_DECL(REQUEST_STATUS,
+    REQUEST_OK,         ///< The callee replied
+    REQUEST_TIMEOUT     ///< The deadline of the request expired before the reply
+)
+
+/**
+ * @brief Correlation id of a request, never 0
+ */
+typedef uint32_t RequestId;
+
+/**
+ * The table of the pending requests of a caller
+ */
+typedef struct requests_t Requests;
+
+/**
+ * @brief Function called when a request is finished
+ *
+ * @note It is called from the thread of the callee or from the timeout thread
+ * of the table : it must only send an event to the mailbox of the caller,
+ * without blocking.
+ * @param caller instance given to requestsNew()
+ * @param id correlation id of the request
+ * @param status REQUEST_OK or REQUEST_TIMEOUT
+ * @param result result given by the callee
+ */
+typedef void (*RequestCallback)(void * caller, RequestId id, REQUEST_STATUS status, intptr_t result);
+
+/**
+ * @brief Allocates the table of the pending requests of a caller
+ *
+ * @param capacity maximum number of pending requests (65535 max)
+ * @param callback function called when a request is finished
+ * @param caller instance of the class that sends the requests
+ */
+extern Requests * requestsNew(uint32_t capacity, RequestCallback callback, void * caller);
+
+/**
+ * @brief Opens a request
+ *
+ * @param timeout delay after which the request is finished with REQUEST_TIMEOUT,
+ * expressed in milliseconds, 0 for no deadline
+ * @return the correlation id of the request, 0 if too many requests are pending
+ */
+extern RequestId requestOpen(Requests * this, uint32_t timeout);
+
+/**
+ * @brief Replies to a request. Called by the callee.
+ *
+ * @retval 0 If the reply has been given to the caller
+ * @retval -1 If the request is not pending anymore (timeout or cancel)
+ */
+extern int requestReply(Requests * this, RequestId id, intptr_t result);
+
+/**
+ * @brief Cancels a pending request : the callback will not be called for it
+ *
+ * @retval 0 If the request has been cancelled
+ * @retval -1 If the request is not pending anymore
+ */
+extern int requestCancel(Requests * this, RequestId id);
+
+/**
+ * @brief Frees the table. The pending requests are dropped.
+ *
+ * Returns once the timeout callbacks in progress are over : none is called afterwards.
+ *
+ * @note The callees must not reply anymore
+ */
+extern void requestsFree(Requests * this);
+
+
+#endif //REQUEST_H
@@ -0,0 +1,111 @@
+/**
+ * @file shard.h
+ *
+ * @brief Shard class that spreads the events of one active class over
+ * several replicas, each one with its own thread and mailbox
+ *
+ * Every event is routed by a key : all the events of a key go to the same
+ * replica, so they are handled in the order they were sent. The number of
+ * replicas grows and shrinks with the depth of their mailboxes, without
+ * breaking the order of a key :
+ * - a replica only starts once the existing ones have handled all the
+ * events they received before it was added (see ShardOps.sync),
+ * - a replica is only removed once it has been stopped, which drains its mailbox.
+ *
+ * How to use :
+ * @code
+ * Example * replica = shardRoute(shard, key);
+ * ExampleEventOne(replica, param);
+ * shardRouteDone(shard);
+ * @endcode
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * The functions of ShardOps take the replicas as void pointers : the active
+ * class is wired with small adapters, e.g. for the Example :
+ * @code
+ * static void * replicaNew(void) { return ExampleNew(); }
+ * static int replicaStart(void * replica) { return ExampleStart(replica); }
+ * @endcode
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+
+
+/**
+ * @brief Functions of the active class that is replicated
+ */
+typedef struct {
+    void * (*create)(void);             ///< Allocates a replica (ExampleNew)
+    int (*start)(void * replica);       ///< Starts a replica (ExampleStart)
+    int (*stop)(void * replica);        ///< Stops a replica after it handled its pending events (ExampleStop).
+                                        ///< Called with the routing locked : the draining actions must not call shardRoute().
+    int (*destroy)(void * replica);     ///< Frees a replica (ExampleFree)
+    long (*pending)(void * replica);    ///< Returns the number of events waiting in the replica mailbox
+    void (*sync)(void * replica);       ///< Returns once the replica handled every event sent before the call (optional)
+} ShardOps;
+
+/**
+ * The shard structure
+ */
+typedef struct shard_t Shard;
+
+/**
+ * @brief Creates and starts minReplicas replicas
+ *
+ * @param ops functions of the replicated class
+ * @param minReplicas number of replicas kept when the mailboxes are empty
+ * @param maxReplicas maximum number of replicas
+ * @param highWatermark mean mailbox depth above which a replica is added
+ * @param lowWatermark mean mailbox depth under which a replica is removed
+ */
+extern Shard * shardNew(const ShardOps * ops, int minReplicas, int maxReplicas, long highWatermark, long lowWatermark);
+
+/**
+ * @brief Returns the replica that handles the given key
+ *
+ * @note The number of replicas cannot change until shardRouteDone() is called,
+ * so the event must be sent in between.
+ * @param key key of the event (connection, device, etc)
+ */
+extern void * shardRoute(Shard * this, uint64_t key);
+
+/**
+ * @brief Ends the routing started by shardRoute()
+ */
+extern void shardRouteDone(Shard * this);
+
+/**
+ * @brief Adds or removes one replica according to the depth of the mailboxes
+ *
+ * @return the number of replicas after the rebalance
+ */
+extern int shardRebalance(Shard * this);
+
+/**
+ * @brief Calls shardRebalance() periodically, from a thread of the shard
+ *
+ * @note Calling it again changes the period. The thread is stopped by shardFree().
+ * @param period delay between two rebalances, in milliseconds
+ */
+extern void shardAutoscale(Shard * this, uint32_t period);
+
+/**
+ * @brief Returns the current number of replicas
+ */
+extern int shardGetCount(Shard * this);
+
+/**
+ * @brief Stops and frees every replica, then the shard
+ */
+extern void shardFree(Shard * this);
+
+
+#endif //SHARD_H
@@ -0,0 +1,101 @@
+/**
+ * @file smarray.h
+ *
+ * @brief State machine array class that runs a whole population of small
+ * identical state machines, without a thread nor a mailbox per instance
+ *
+ * The states and the pending events are stored as columns (one byte per
+ * instance each) and the transition table is packed in a single array, so
+ * stepping the population is a tight loop over the columns. The ACTIONs are
+ * then dispatched once per ACTION, with the list of the instances that
+ * triggered it.
+ *
+ * The conventions of the active classes are kept :
+ * - the state 0 is S_FORGET : an event without transition is ignored,
+ * - the event 0 is E_NOP : it means that no event is pending,
+ * - the action 0 is A_NOP : it is never dispatched.
+ *
+ * @note A state machine array is not thread safe : it must be stepped and
+ * fed by a single thread (the thread of the active object that owns it).
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef SMARRAY_H
+#define SMARRAY_H
+
+#include <stdint.h>
+
+
+/**
+ * @brief Transition of the state machine, same as the Transition of an active class
+ */
+typedef struct {
+    uint8_t nextState;  ///< Next STATE of the state machine (0 to forget the event)
+    uint8_t action;     ///< ACTION done before going in the next STATE
+} SmArrayTransition;
+
+/**
+ * The state machine array structure
+ */
+typedef struct smarray_t SmArray;
+
+/**
+ * @brief Function called for all the instances that triggered an ACTION during a step
+ *
+ * @note Events posted by the ACTION are handled at the next step
+ * @param caller instance given to smArrayNew()
+ * @param indices instances that triggered the ACTION
+ * @param count number of instances
+ */
+typedef void (*SmArrayAction)(void * caller, const uint32_t * indices, uint32_t count);
+
+/**
+ * @brief Allocates a population of state machines, all in the initial state
+ *
+ * @param size number of state machines
+ * @param nbStates number of STATEs (256 max)
+ * @param nbEvents number of EVENTs (256 max)
+ * @param table transition table, stateMachine[nbStates][nbEvents]
+ * @param nbActions number of ACTIONs (256 max)
+ * @param actions functions of the ACTIONs, actionPtr[nbActions]. The first one (A_NOP) is never called.
+ * @param initialState initial state of every state machine
+ * @param caller instance given back to the ACTION functions
+ * @retval NULL If a transition leads to an unknown STATE or ACTION, or to an
+ * ACTION without function, or if the initial state is not a STATE of the table
+ */
+extern SmArray * smArrayNew(uint32_t size, uint32_t nbStates, uint32_t nbEvents, const SmArrayTransition * table,
+                            uint32_t nbActions, const SmArrayAction * actions, uint8_t initialState, void * caller);
+
+/**
+ * @brief Posts an event to one state machine
+ *
+ * @retval 0 If the event will be handled at the next step
+ * @retval -1 If the state machine already has a pending event : call smArrayStep() first,
+ * or if the index or the event is out of range
+ */
+extern int smArrayPost(SmArray * this, uint32_t index, uint8_t event);
+
+/**
+ * @brief Handles every pending event, then dispatches the ACTIONs
+ *
+ * @return the number of events handled
+ */
+extern uint32_t smArrayStep(SmArray * this);
+
+/**
+ * @brief Returns the current state of one state machine
+ */
+extern uint8_t smArrayGetState(SmArray * this, uint32_t index);
+
+/**
+ * @brief Frees the population
+ */
+extern void smArrayFree(SmArray * this);
+
+
+#endif //SMARRAY_H
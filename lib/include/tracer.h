@@ -0,0 +1,114 @@
+/**
+ * @file tracer.h
+ *
+ * @brief Tracer class that records the timeline of the active objects
+ * (mailbox messages, actions, watchdog expiries) in memory and exports
+ * it as a Chrome trace JSON file, readable by chrome://tracing and Perfetto
+ *
+ * The tracer is disabled by default : every record function returns
+ * immediately until tracerEnable() is called.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdint.h>
+
+
+/**
+ * @def TRACER_MAX_THREADS
+ *
+ * The maximum number of threads that can be named in the trace
+ */
+#define TRACER_MAX_THREADS (256)
+
+/**
+ * @def TRACER_THREAD_NAME_LENGTH
+ *
+ * The maximum length of a thread name, including the null terminal character
+ */
+#define TRACER_THREAD_NAME_LENGTH (32)
+
+
+/**
+ * @brief Allocates the events buffer and starts recording
+ *
+ * @note Must be called before the active objects are started
+ * @param capacity maximum number of events kept in memory. The following ones are dropped.
+ */
+extern void tracerEnable(uint32_t capacity);
+
+/**
+ * @brief Stops recording. The recorded events are kept until the next dump.
+ */
+extern void tracerDisable(void);
+
+/**
+ * @brief Returns the current timestamp of the tracer, or 0 if it is disabled
+ *
+ * @note Used to get the start of a slice before calling tracerSlice() or tracerFlow()
+ */
+extern uint64_t tracerNow(void);
+
+/**
+ * @brief Gives a name to the calling thread in the trace
+ *
+ * @param name name of the thread (copied)
+ */
+extern void tracerNameThread(const char * name);
+
+/**
+ * @brief Records a slice of the calling thread, from start to now
+ *
+ * @note cat, name and argName must be static strings : only their address is stored
+ * @param start value returned by tracerNow() at the beginning of the slice
+ * @param argName name of the argument displayed with the slice
+ * @param arg value of the argument
+ */
+extern void tracerSlice(const char * cat, const char * name, uint64_t start, const char * argName, int64_t arg);
+
+/**
+ * @brief Records a mailbox slice, from start to now, that starts or ends a message flow arrow
+ *
+ * @param start value returned by tracerNow() at the beginning of the slice
+ * @param flowId identifier shared by the send and the receive of a message
+ * @param isEnd 0 for the send of the message, 1 for its receive
+ * @param mailboxId identifier of the mailbox displayed with the slice
+ */
+extern void tracerFlow(const char * name, uint64_t start, uint64_t flowId, int isEnd, int64_t mailboxId);
+
+/**
+ * @brief Records an instant event of the calling thread
+ *
+ * @note cat, name and argName must be static strings : only their address is stored
+ */
+extern void tracerInstant(const char * cat, const char * name, const char * argName, int64_t arg);
+
+/**
+ * @brief Writes the recorded events in a Chrome trace JSON file
+ *
+ * @param path path of the file to write
+ * @retval 0 If the file has been written
+ * @retval -1 If the file could not be written
+ */
+extern int tracerDump(const char * path);
+
+/**
+ * @brief Writes the trace in a file each time the process receives the given signal
+ *
+ * A dedicated thread waits for the signal, so the file is not written from a signal handler.
+ *
+ * @note Must be called before any other thread is created, so that they all block the signal
+ * @param signo signal that triggers the dump (SIGUSR1 for example)
+ * @param path path of the file to write
+ */
+extern void tracerDumpOnSignal(int signo, const char * path);
+
+
+#endif //TRACER_H
@@ -0,0 +1,155 @@
+/**
+ * @file typedmailbox.h
+ *
+ * @brief Macro that generates a mailbox specialized to one message type
+ *
+ * Unlike Mailbox, which copies untyped messages whose size is only known at
+ * runtime, the generated mailbox stores the messages inline, one per cache
+ * line aligned slot, and its send and receive functions are static inline
+ * functions that copy a Type : the compiler knows the size of every copy and
+ * can turn it into a few moves.
+ *
+ * The mailbox can be used by several producers and by one consumer. The
+ * producers block when it is full, the consumer blocks when it is empty.
+ *
+ * How to use :
+ * @code
+ * MAILBOX_DECL(Example, Msg, 16)      // ExampleMailbox, of 16 Msg
+ *
+ * ExampleMailbox mb;
+ * ExampleMailboxInit(&mb);
+ * ExampleMailboxSend(&mb, &msg);      // In a producer thread
+ * ExampleMailboxReceive(&mb, &msg);   // In the consumer thread
+ * ExampleMailboxDestroy(&mb);
+ * @endcode
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef TYPEDMAILBOX_H
+#define TYPEDMAILBOX_H
+
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+
+/**
+ * @def TYPEDMAILBOX_CACHE_LINE
+ *
+ * Size of a cache line : each slot and each index of the mailbox has its own lines
+ */
+#define TYPEDMAILBOX_CACHE_LINE (64)
+
+/**
+ * @def MAILBOX_DECL
+ *
+ * @brief Declares the Name##Mailbox type and its functions, for messages of type Type
+ *
+ * Generated functions :
+ * - void Name##MailboxInit(Name##Mailbox * this)
+ * - void Name##MailboxSend(Name##Mailbox * this, const Type * msg) : blocking if the mailbox is full
+ * - int Name##MailboxTrySend(Name##Mailbox * this, const Type * msg) : -1 if the mailbox is full
+ * - void Name##MailboxReceive(Name##Mailbox * this, Type * msg) : blocking if the mailbox is empty
+ * - int Name##MailboxTryReceive(Name##Mailbox * this, Type * msg) : -1 if the mailbox is empty
+ * - long Name##MailboxGetCount(Name##Mailbox * this)
+ * - void Name##MailboxDestroy(Name##Mailbox * this)
+ *
+ * @param Name prefix of the generated type and functions
+ * @param Type type of the messages
+ * @param capacity number of messages, a power of 2
+ */
+#define MAILBOX_DECL(Name, Type, capacity) \
+    typedef char Name##MailboxCapacityIsAPowerOf2[(((capacity) & ((capacity) - 1)) == 0 && (capacity) > 0) ? 1 : -1]; \
+    \
+    typedef struct { \
+        uint64_t seq;   /* Position of the message it holds + 1, or of the next message it can hold */ \
+        Type msg; \
+    } __attribute__((aligned(TYPEDMAILBOX_CACHE_LINE))) Name##MailboxSlot; \
+    \
+    typedef struct { \
+        Name##MailboxSlot slots[capacity]; \
+        uint64_t sendPos __attribute__((aligned(TYPEDMAILBOX_CACHE_LINE))); /* Shared by the producers */ \
+        uint64_t receivePos __attribute__((aligned(TYPEDMAILBOX_CACHE_LINE))); /* Only used by the consumer */ \
+        sem_t messages;     /* Messages that can be received */ \
+        sem_t spaces;       /* Free slots */ \
+    } Name##Mailbox; \
+    \
+    static inline void Name##MailboxInit(Name##Mailbox * this) { \
+        for (uint64_t i = 0; i < (capacity); i++) { \
+            this->slots[i].seq = i; \
+        } \
+        this->sendPos = 0; \
+        this->receivePos = 0; \
+        sem_init(&this->messages, 0, 0); \
+        sem_init(&this->spaces, 0, (capacity)); \
+    } \
+    \
+    /* Writes the message once a free slot has been taken */ \
+    static inline void Name##MailboxPut(Name##Mailbox * this, const Type * msg) { \
+        uint64_t pos = __atomic_fetch_add(&this->sendPos, 1, __ATOMIC_RELAXED); \
+        Name##MailboxSlot * slot = &this->slots[pos & ((capacity) - 1)]; \
+        slot->msg = *msg; \
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE); \
+        sem_post(&this->messages); \
+    } \
+    \
+    static inline void Name##MailboxSend(Name##Mailbox * this, const Type * msg) { \
+        while (sem_wait(&this->spaces) == -1 && errno == EINTR) { \
+        } \
+        Name##MailboxPut(this, msg); \
+    } \
+    \
+    static inline int Name##MailboxTrySend(Name##Mailbox * this, const Type * msg) { \
+        if (sem_trywait(&this->spaces) == -1) { \
+            return -1; \
+        } \
+        Name##MailboxPut(this, msg); \
+        return 0; \
+    } \
+    \
+    /* Reads the next message once it has been counted */ \
+    static inline void Name##MailboxTake(Name##Mailbox * this, Type * msg) { \
+        uint64_t pos = this->receivePos++; \
+        Name##MailboxSlot * slot = &this->slots[pos & ((capacity) - 1)]; \
+        /* A later message may have been counted before this one is written */ \
+        while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) { \
+            sched_yield(); \
+        } \
+        *msg = slot->msg; \
+        __atomic_store_n(&slot->seq, pos + (capacity), __ATOMIC_RELEASE); \
+        sem_post(&this->spaces); \
+    } \
+    \
+    static inline void Name##MailboxReceive(Name##Mailbox * this, Type * msg) { \
+        while (sem_wait(&this->messages) == -1 && errno == EINTR) { \
+        } \
+        Name##MailboxTake(this, msg); \
+    } \
+    \
+    static inline int Name##MailboxTryReceive(Name##Mailbox * this, Type * msg) { \
+        if (sem_trywait(&this->messages) == -1) { \
+            return -1; \
+        } \
+        Name##MailboxTake(this, msg); \
+        return 0; \
+    } \
+    \
+    static inline long Name##MailboxGetCount(Name##Mailbox * this) { \
+        int count = 0; \
+        sem_getvalue(&this->messages, &count); \
+        return count; \
+    } \
+    \
+    static inline void Name##MailboxDestroy(Name##Mailbox * this) { \
+        sem_destroy(&this->messages); \
+        sem_destroy(&this->spaces); \
+    }
+
+
+#endif //TYPEDMAILBOX_H
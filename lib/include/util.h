@@ -114,7 +114,7 @@
  */
 #define ENUM_DECL(name, ARGS...) \
     typedef enum { toEnum(ARGS) NB_##name } name; \
-    static const char * name##_toString[] = { toString(ARGS) #name };
+    static const char * name##_toString[] __attribute__((unused)) = { toString(ARGS) #name };
 
 /**
  * @def TRACE
@@ -164,7 +164,10 @@
 
 
 #else
-    #define ENUM_DECL(name, ARGS...) typedef enum { toEnum(ARGS) NB_##name } name;
+    /* The string array is kept without debug so that the tracer can name the actions */
+    #define ENUM_DECL(name, ARGS...) \
+        typedef enum { toEnum(ARGS) NB_##name } name; \
+        static const char * name##_toString[] __attribute__((unused)) = { toString(ARGS) #name };
     #define ERROR(errorCondition, fmt, ...)
     #define TRACE(fmt, ...)
     #define STOP_ON_ERROR(errorCondition, fmt, ...)
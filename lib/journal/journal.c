@@ -0,0 +1,509 @@
+/**
+ * @file journal.c
+ *
+ * @brief Journal class that keeps the messages of a durable mailbox in
+ * memory-mapped files, so that they survive a crash of the process
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "journal.h"
+
+
+/**
+ * @def Magic numbers of the journal files
+ */
+#define META_MAGIC (0x4A4D4554)     // "JMET"
+#define SEGMENT_MAGIC (0x4A534547)  // "JSEG"
+
+/**
+ * @def Alignment of the records in a segment
+ */
+#define RECORD_ALIGN (8)
+
+/**
+ * @def Longest suffix added to the path of the journal : ".<index>.seg" with a 32 bits index
+ */
+#define SEGMENT_SUFFIX_LENGTH (15)
+
+/**
+ * @brief Content of the meta file, shared by all the segments
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t firstSegment;  ///< Oldest segment still on the disk
+    uint32_t lastSegment;   ///< Segment in which the messages are appended
+    uint32_t reserved;
+    uint64_t ackedSeq;      ///< Cumulative acknowledgement
+} JournalMeta;
+
+/**
+ * @brief Beginning of a segment file
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t index;
+    uint64_t firstSeq;      ///< Number of the first message of the segment
+} JournalSegment;
+
+/**
+ * @brief Header of a message in a segment, followed by the message
+ *
+ * The length is written last : a record whose length is 0 is the end of the
+ * segment, even if the process died while writing it.
+ */
+typedef struct {
+    uint32_t length;
+    uint32_t checksum;      ///< Detects a record torn by a crash of the system
+    uint64_t seq;
+    uint64_t timestamp;     ///< CLOCK_MONOTONIC time of the append, in nanoseconds
+} JournalRecord;
+
+struct journal_t {
+    char path[JOURNAL_PATH_LENGTH];
+    uint32_t segmentSize;
+    uint32_t syncBatch;
+    int keep;
+    JournalMeta * meta;     ///< Mapping of the meta file
+    char * segment;         ///< Mapping of the last segment
+    size_t offset;          ///< Where the next record is written
+    size_t syncedOffset;    ///< Everything before has been written back to the disk
+    uint32_t unsynced;      ///< Messages appended since the last msync
+    uint64_t nextSeq;
+    pthread_mutex_t mutex;
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static uint64_t journalNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief FNV-1a hash of a message
+ */
+static uint32_t journalChecksum(const void * data, uint32_t length, uint64_t seq) {
+    const unsigned char * bytes = data;
+    uint32_t hash = 2166136261U ^ (uint32_t) seq;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    return hash;
+}
+
+static size_t journalRecordSize(uint32_t length) {
+    return (sizeof(JournalRecord) + length + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+}
+
+/**
+ * @brief Writes the path of a segment of the journal at path
+ *
+ * @retval -1 If the path of the segment is too long
+ */
+static int journalSegmentPath(const char * path, uint32_t index, char * segmentPath) {
+    int length = snprintf(segmentPath, JOURNAL_PATH_LENGTH, "%s.%08u.seg", path, index);
+    return (length < 0 || length >= JOURNAL_PATH_LENGTH) ? -1 : 0;
+}
+
+/**
+ * @brief Returns the record at offset of a segment, or NULL at the end of the segment
+ */
+static const JournalRecord * journalRecordAt(const char * segment, size_t size, size_t offset) {
+    if (offset + sizeof(JournalRecord) > size) {
+        return NULL;
+    }
+    const JournalRecord * record = (const JournalRecord *) (segment + offset);
+    uint32_t length = __atomic_load_n(&record->length, __ATOMIC_ACQUIRE);
+    if (length == 0 || offset + journalRecordSize(length) > size
+        || record->checksum != journalChecksum(record + 1, length, record->seq)) {
+        return NULL;
+    }
+    return record;
+}
+
+/**
+ * @brief Maps a segment file
+ *
+ * @param create non zero to create the segment, which starts at the message firstSeq
+ * @retval NULL If the segment could not be mapped
+ */
+static char * journalMapSegment(Journal * this, uint32_t index, int create, uint64_t firstSeq) {
+    char path[JOURNAL_PATH_LENGTH];
+    if (journalSegmentPath(this->path, index, path) != 0) {
+        return NULL;
+    }
+
+    int fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0600);
+    ERROR(fd == -1, "Error when opening the journal segment %s\n", path)
+    if (fd == -1) {
+        return NULL;
+    }
+    if (create && ftruncate(fd, this->segmentSize) == -1) {
+        ERROR(1, "Error when sizing the journal segment %s\n", path)
+        close(fd);
+        return NULL;
+    }
+    char * segment = mmap(NULL, this->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ERROR(segment == MAP_FAILED, "Error when mapping the journal segment %s\n", path)
+    if (segment == MAP_FAILED) {
+        return NULL;
+    }
+
+    JournalSegment * header = (JournalSegment *) segment;
+    if (create) {
+        header->index = index;
+        header->firstSeq = firstSeq;
+        __atomic_store_n(&header->magic, SEGMENT_MAGIC, __ATOMIC_RELEASE);
+    } else if (header->magic != SEGMENT_MAGIC) {
+        ERROR(1, "The journal segment %s is corrupted\n", path)
+        munmap(segment, this->segmentSize);
+        return NULL;
+    }
+    return segment;
+}
+
+/**
+ * @brief Returns the number of the first message of a segment, or 0 if it cannot be read
+ */
+static uint64_t journalSegmentFirstSeq(Journal * this, uint32_t index) {
+    char path[JOURNAL_PATH_LENGTH];
+    if (journalSegmentPath(this->path, index, path) != 0) {
+        return 0;
+    }
+
+    JournalSegment header = { 0 };
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t size = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    return (size == sizeof(header) && header.magic == SEGMENT_MAGIC) ? header.firstSeq : 0;
+}
+
+/**
+ * @brief Deletes the oldest segments whose messages have all been acknowledged
+ *
+ * A segment is acknowledged when the first message of the next one follows the acknowledgement.
+ */
+static void journalPurge(Journal * this) {
+    uint64_t acked = journalGetAcked(this);
+    while (this->meta->firstSegment < this->meta->lastSegment) {
+        uint64_t nextFirstSeq = journalSegmentFirstSeq(this, this->meta->firstSegment + 1);
+        if (nextFirstSeq == 0 || nextFirstSeq - 1 > acked) {
+            break;
+        }
+        char path[JOURNAL_PATH_LENGTH];
+        if (journalSegmentPath(this->path, this->meta->firstSegment, path) != 0) {
+            break;
+        }
+        unlink(path);
+        TRACE("[JOURNAL] Segment %s deleted\n", path)
+        this->meta->firstSegment++;
+    }
+}
+
+/**
+ * @brief Writes the records appended since the last msync back to the disk
+ */
+static int journalSyncRange(Journal * this) {
+    if (this->offset == this->syncedOffset) {
+        return 0;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = this->syncedOffset & ~(size_t) (page - 1);
+    int err = msync(this->segment + start, this->offset - start, MS_SYNC);
+    ERROR(err == -1, "Error when writing the journal %s back to the disk\n", this->path)
+    if (err == 0) {
+        this->syncedOffset = this->offset;
+        this->unsynced = 0;
+    }
+    return err;
+}
+
+/**
+ * @brief Goes on in a new segment
+ */
+static int journalRotate(Journal * this) {
+    journalSyncRange(this);
+    munmap(this->segment, this->segmentSize);
+
+    uint32_t index = this->meta->lastSegment + 1;
+    this->segment = journalMapSegment(this, index, 1, this->nextSeq);
+    if (this->segment == NULL) {
+        return -1;
+    }
+    this->meta->lastSegment = index;
+    msync(this->meta, sizeof(JournalMeta), MS_SYNC);
+    this->offset = sizeof(JournalSegment);
+    this->syncedOffset = 0;
+    TRACE("[JOURNAL] Rotation of %s to the segment %u\n", this->path, index)
+
+    if (!this->keep) {
+        journalPurge(this);
+    }
+    return 0;
+}
+
+/**
+ * @brief Calls the callback for the messages of a mapped segment
+ *
+ * @param speed pace of the replay (see journalReplayFile), 0 for full speed
+ * @param origin timestamps of the first replayed message and of its replay, set by the first call
+ */
+static long journalReplaySegment(const char * segment, size_t size, uint64_t afterSeq, double speed,
+                                 uint64_t origin[2], JournalCallback callback, void * caller) {
+    long count = 0;
+    size_t offset = sizeof(JournalSegment);
+    const JournalRecord * record;
+
+    while ((record = journalRecordAt(segment, size, offset)) != NULL) {
+        offset += journalRecordSize(record->length);
+        if (record->seq <= afterSeq) {
+            continue;
+        }
+        if (speed > 0) {
+            if (origin[0] == 0) {
+                origin[0] = record->timestamp;
+                origin[1] = journalNow();
+            }
+            uint64_t due = origin[1] + (uint64_t) ((double) (record->timestamp - origin[0]) / speed);
+            uint64_t now = journalNow();
+            if (due > now) {
+                struct timespec delay = {
+                    .tv_sec = (time_t) ((due - now) / 1000000000ULL),
+                    .tv_nsec = (long) ((due - now) % 1000000000ULL)
+                };
+                nanosleep(&delay, NULL);
+            }
+        }
+        callback(caller, record->seq, record + 1, record->length);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Replays the segments first to last of the journal at path
+ */
+static long journalReplaySegments(const char * path, uint32_t first, uint32_t last, uint64_t afterSeq,
+                                  double speed, JournalCallback callback, void * caller) {
+    long count = 0;
+    uint64_t origin[2] = { 0, 0 };
+
+    for (uint32_t index = first; index <= last; index++) {
+        char segmentPath[JOURNAL_PATH_LENGTH];
+        if (journalSegmentPath(path, index, segmentPath) != 0) {
+            return -1;
+        }
+
+        int fd = open(segmentPath, O_RDONLY);
+        ERROR(fd == -1, "Error when opening the journal segment %s\n", segmentPath)
+        if (fd == -1) {
+            return -1;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(JournalSegment)) {
+            close(fd);
+            return -1;
+        }
+        char * segment = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (segment == MAP_FAILED) {
+            return -1;
+        }
+        if (((JournalSegment *) segment)->magic == SEGMENT_MAGIC) {
+            count += journalReplaySegment(segment, info.st_size, afterSeq, speed, origin, callback, caller);
+        }
+        munmap(segment, info.st_size);
+    }
+    return count;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+Journal * journalOpen(const char * path, uint32_t segmentSize, uint32_t syncBatch, int keep) {
+    int wrong = (strlen(path) + SEGMENT_SUFFIX_LENGTH >= JOURNAL_PATH_LENGTH);
+    ERROR(wrong, "The path of the journal %s is too long\n", path)
+    if (wrong) {
+        return NULL;
+    }
+
+    Journal * this = (Journal *) calloc(1, sizeof(Journal));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the journal : ")
+    snprintf(this->path, JOURNAL_PATH_LENGTH, "%s", path);
+    this->segmentSize = segmentSize;
+    this->syncBatch = syncBatch;
+    this->keep = keep;
+    pthread_mutex_init(&this->mutex, NULL);
+
+    char metaPath[JOURNAL_PATH_LENGTH];
+    snprintf(metaPath, JOURNAL_PATH_LENGTH, "%s.meta", path);
+    int fd = open(metaPath, O_RDWR | O_CREAT, 0600);
+    ERROR(fd == -1, "Error when opening the journal %s\n", metaPath)
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1
+        || (info.st_size == 0 && ftruncate(fd, sizeof(JournalMeta)) == -1)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        free(this);
+        return NULL;
+    }
+    this->meta = mmap(NULL, sizeof(JournalMeta), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->meta == MAP_FAILED) {
+        ERROR(1, "Error when mapping the journal %s\n", metaPath)
+        free(this);
+        return NULL;
+    }
+
+    if (this->meta->magic != META_MAGIC) { // New journal
+        this->meta->firstSegment = 0;
+        this->meta->lastSegment = 0;
+        this->meta->ackedSeq = 0;
+        this->meta->magic = META_MAGIC;
+        this->nextSeq = 1;
+        this->segment = journalMapSegment(this, 0, 1, this->nextSeq);
+        this->offset = sizeof(JournalSegment);
+    } else { // The appends go on after the last valid record
+        this->segment = journalMapSegment(this, this->meta->lastSegment, 0, 0);
+        if (this->segment != NULL) {
+            this->nextSeq = ((JournalSegment *) this->segment)->firstSeq;
+            this->offset = sizeof(JournalSegment);
+            const JournalRecord * record;
+            while ((record = journalRecordAt(this->segment, this->segmentSize, this->offset)) != NULL) {
+                this->nextSeq = record->seq + 1;
+                this->offset += journalRecordSize(record->length);
+            }
+            // Clears what a torn record may have left, so that the next one is not mistaken
+            memset(this->segment + this->offset, 0, this->segmentSize - this->offset);
+        }
+    }
+    if (this->segment == NULL) {
+        munmap(this->meta, sizeof(JournalMeta));
+        free(this);
+        return NULL;
+    }
+    this->syncedOffset = this->offset;
+
+    TRACE("[JOURNAL] %s opened : next message %lu, acknowledged up to %lu\n", path,
+          (unsigned long) this->nextSeq, (unsigned long) this->meta->ackedSeq)
+    return this;
+}
+
+
+uint64_t journalAppend(Journal * this, const void * data, uint32_t length) {
+    size_t size = journalRecordSize(length);
+    if (size > this->segmentSize - sizeof(JournalSegment)) {
+        ERROR(1, "Message of %u bytes too big for the journal %s\n", length, this->path)
+        return 0;
+    }
+
+    pthread_mutex_lock(&this->mutex);
+    if (this->offset + size > this->segmentSize && journalRotate(this) == -1) {
+        pthread_mutex_unlock(&this->mutex);
+        return 0;
+    }
+
+    uint64_t seq = this->nextSeq++;
+    JournalRecord * record = (JournalRecord *) (this->segment + this->offset);
+    record->seq = seq;
+    record->timestamp = journalNow();
+    memcpy(record + 1, data, length);
+    record->checksum = journalChecksum(data, length, seq);
+    __atomic_store_n(&record->length, length, __ATOMIC_RELEASE);
+    this->offset += size;
+
+    if (this->syncBatch > 0 && ++this->unsynced >= this->syncBatch) {
+        journalSyncRange(this);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return seq;
+}
+
+
+void journalAck(Journal * this, uint64_t seq) {
+    uint64_t acked = __atomic_load_n(&this->meta->ackedSeq, __ATOMIC_ACQUIRE);
+    while (seq > acked
+           && !__atomic_compare_exchange_n(&this->meta->ackedSeq, &acked, seq, 0,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+
+uint64_t journalGetAcked(Journal * this) {
+    return __atomic_load_n(&this->meta->ackedSeq, __ATOMIC_ACQUIRE);
+}
+
+
+int journalSync(Journal * this) {
+    pthread_mutex_lock(&this->mutex);
+    int err = journalSyncRange(this);
+    pthread_mutex_unlock(&this->mutex);
+    return err;
+}
+
+
+long journalReplay(Journal * this, uint64_t afterSeq, JournalCallback callback, void * caller) {
+    pthread_mutex_lock(&this->mutex);
+    uint32_t first = this->meta->firstSegment;
+    uint32_t last = this->meta->lastSegment;
+    pthread_mutex_unlock(&this->mutex);
+
+    long count = journalReplaySegments(this->path, first, last, afterSeq, 0, callback, caller);
+    TRACE("[JOURNAL] %ld messages replayed from %s\n", count, this->path)
+    return count;
+}
+
+
+long journalReplayFile(const char * path, double speed, JournalCallback callback, void * caller) {
+    char metaPath[JOURNAL_PATH_LENGTH];
+    snprintf(metaPath, JOURNAL_PATH_LENGTH, "%s.meta", path);
+
+    JournalMeta meta = { 0 };
+    int fd = open(metaPath, O_RDONLY);
+    ERROR(fd == -1, "Error when opening the journal %s\n", metaPath)
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t size = pread(fd, &meta, sizeof(meta), 0);
+    close(fd);
+    if (size != sizeof(meta) || meta.magic != META_MAGIC) {
+        ERROR(1, "The journal %s is corrupted\n", metaPath)
+        return -1;
+    }
+
+    return journalReplaySegments(path, meta.firstSegment, meta.lastSegment, 0, speed, callback, caller);
+}
+
+
+void journalClose(Journal * this) {
+    journalSyncRange(this);
+    munmap(this->segment, this->segmentSize);
+    msync(this->meta, sizeof(JournalMeta), MS_SYNC);
+    munmap(this->meta, sizeof(JournalMeta));
+    pthread_mutex_destroy(&this->mutex);
+    free(this);
+}
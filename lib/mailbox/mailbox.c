@@ -11,54 +11,510 @@
  * Based on templates written by Thomas CRAVIC, Nathan LE GRANVALLET, Clément PUYBAREAU, Louis FROGER
  */
 
+#define _GNU_SOURCE
+
 #include "mailbox.h"
 #include "errno.h"
+#include <limits.h>
+#include <unistd.h>
+#include "tracer.h"
+#include "journal.h"
+#include "numa.h"
+
+/**
+ * @brief Mailboxes counter used to identify the mailboxes in the trace
+ */
+static uint32_t mailboxCounter = 0;
+
+/**
+ * @def MAILBOX_WAKE_PRIORITY
+ *
+ * Priority of the message that wakes the consumer up when the first message
+ * is spilled. It is never received by the caller.
+ */
+#define MAILBOX_WAKE_PRIORITY (MAILBOX_URGENT_PRIORITY + 1)
+
+/**
+ * @brief Options of mailboxTimedPost()
+ */
+#define POST_JOURNALED (1)  ///< Appended to the journal of a durable mailbox
+#define POST_UNBOUNDED (2)  ///< Spilled beyond the hard cap rather than waiting
+
+/**
+ * @brief Already expired deadline : mq_timedsend and mq_timedreceive do not wait
+ */
+static const struct timespec mailboxExpired = { 0, 0 };
+
+/**
+ * @def MAILBOX_CHUNK_BYTES
+ *
+ * Bytes allocated for a segment : with the header of numaAlloc(), a placed segment fills MAILBOX_CHUNK_SIZE
+ */
+#define MAILBOX_CHUNK_BYTES (MAILBOX_CHUNK_SIZE - NUMA_HEADER_SIZE)
+
+/**
+ * @brief Segment of the spill of a queue
+ */
+typedef struct mailbox_chunk_t {
+    struct mailbox_chunk_t * next;
+    uint32_t head;      ///< Index of the next message to receive
+    uint32_t tail;      ///< Index of the next free place
+    char frames[];
+} MailboxChunk;
+
+/**
+ * @brief Empty segments shared by all the mailboxes, in one stack per node.
+ * The first stack holds the segments that are not placed.
+ */
+static MailboxChunk * mailboxFreeChunks[NUMA_MAX_NODES + 1];
+static int mailboxFreeChunkCount[NUMA_MAX_NODES + 1];
+static pthread_mutex_t mailboxChunkMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Mailboxes created in advance, in a stack
+ */
+struct mailbox_pool_t {
+    char objName[SIZE_BOX_NAME];
+    __syscall_slong_t maxMsgSize;
+    Mailbox ** mailboxes;
+    int count;          ///< Number of mailboxes in the stack
+    int capacity;       ///< Size of the stack
+    pthread_mutex_t mutex;
+};
+
+/**
+ * @brief Part of a mailboxPoolFill() done by one thread
+ */
+typedef struct {
+    MailboxPool * pool;
+    Mailbox ** mailboxes;   ///< Where the thread stores its mailboxes
+    int firstCounter;
+    int count;
+} MailboxPoolSlice;
+
+/**
+ * @brief Message taken out of the queue but not received yet
+ */
+typedef struct mailbox_node_t {
+    struct mailbox_node_t * next;
+    uint64_t seq;       ///< Arrival order of the message
+    uint64_t journalSeq; ///< Number of the message in the journal, 0 if it is not journaled
+    char msg[];
+} MailboxNode;
+
+/**
+ * @brief FIFO of the messages of one EVENT
+ */
+typedef struct {
+    MailboxNode * head;
+    MailboxNode * tail;
+} MailboxFifo;
 
 struct mailbox_t {
     char queueName[SIZE_BOX_NAME];
     mqd_t mq;
     size_t mqSize;
+    int objCounter;     ///< Instance number of the object, in the name of the queue
+    uint32_t traceId;   ///< Identifier of the mailbox in the trace
+    uint32_t sendSeq;   ///< Number of messages sent, used to link a send to its receive in the trace
+    uint64_t posted;    ///< Number of messages put in the queue or in the spill
+    uint64_t pulled;    ///< Number of messages taken out of them : mailboxTryReceive() skips the system call when equal
+    int creditsEnabled; ///< Flow control enabled
+    int credits;        ///< Messages that can be sent before the consumer grants new credits
+
+    /* Messages skipped by mailboxReceiveMatching, only used by the consumer thread */
+    MailboxFifo stash[MAILBOX_MAX_EVENTS + 1]; ///< One FIFO per EVENT, the last one for the other EVENTs
+    uint64_t stashMask;     ///< Bit n set if the FIFO n is not empty
+    long stashCount;        ///< Number of stashed messages
+    uint64_t pullSeq;       ///< Number of messages taken out of the queue
+    MailboxNode * freeNodes; ///< Nodes kept for reuse
+    uint64_t lastSeq;       ///< Arrival order of the last received message
+    MailboxFifo deferred;   ///< Messages deferred until the next mailboxRecall
+    long deferredCount;     ///< Number of deferred messages
+
+    /* Durable mode */
+    Journal * journal;      ///< Journal of the sent messages, NULL if the mailbox is not durable
+    size_t mqMsgSize;       ///< Size of the frames of the queue : the message, its flow and its number in the journal
+    pthread_mutex_t journalMutex; ///< Keeps the journal and the queue in the same order
+    uint64_t pullJournalSeq; ///< Number in the journal of the last message taken out of the queue
+    uint64_t lastJournalSeq; ///< Number in the journal of the last received message
+    uint64_t maxJournalSeq; ///< Highest number received from the journal
+
+    /* Messages sent while the queue was full, received after the ones of the queue */
+    pthread_mutex_t spillMutex;
+    pthread_cond_t spillCond;   ///< A spilled message has been received
+    MailboxChunk * spillHead;   ///< Oldest segment
+    MailboxChunk * spillTail;   ///< Segment being filled
+    long spilled;           ///< Number of spilled messages, read without the lock by the fast paths
+    long spillLimit;        ///< Hard cap of the spilled messages, 0 if the mailbox does not spill
+    uint32_t chunkCapacity; ///< Number of messages of a segment
+    int node;               ///< Node of the mailbox and of its segments, NUMA_NO_NODE if not placed
 };
 
 /**
- * @brief Initializes the queue
+ * @brief Returns the identifier of the trace flow of the message number seq
  */
-extern Mailbox * mailboxInit(char * objName, int objCounter, __syscall_slong_t maxMsgSize) {
-    Mailbox * this = (Mailbox *) malloc(sizeof(Mailbox));
-    sprintf(this->queueName, NAME_MQ_BOX, objName, objCounter);
+#define FLOW_ID(this, seq) (((uint64_t) (this)->traceId << 32) | (seq))
 
-    TRACE("[MAILBOX] Defined the Queue name : %s\n", this->queueName)
+/**
+ * @brief Offsets in a frame of the queue of the trace flow and of the number in the journal, which follow the message
+ */
+#define FRAME_FLOW(this) ((this)->mqSize)
+#define FRAME_JOURNAL_SEQ(this) ((this)->mqSize + sizeof(uint64_t))
 
-    TRACE("[MAILBOX] Oppening the mailbox %s\n", this->queueName)
-    /* Destroying the mailbox if it already exists */
-    errno = 0;
-    int err = mq_unlink(this->queueName);
-    if (err == -1) {
-        if (errno == EACCES) {
-            TRACE("ERROR : mq_unlink failed -> no permission to unlink the queue (continue)\n");
-        } else if (errno == ENAMETOOLONG) {
-            TRACE("ERROR : mq_unlink failed -> name too long (continue)\n");
-        } else if (errno == ENOENT) {
-            TRACE("ERROR : mq_unlink failed -> no message queue to unlink (continue)\n");
+static Mailbox * mailboxCreate(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal,
+                               int node);
+static void mailboxPost(Mailbox * this, char * msg);
+static int mailboxTimedPost(Mailbox * this, char * msg, unsigned int priority, const struct timespec * deadline,
+                            int flags);
+static void mailboxPull(Mailbox * this, char * msg);
+static int mailboxTimedPull(Mailbox * this, char * msg, const struct timespec * deadline);
+
+/**
+ * @brief Returns the EVENT of a message, which is the first field of the message
+ */
+static int mailboxEventOf(const char * msg) {
+    int event;
+    memcpy(&event, msg, sizeof(int));
+    return event;
+}
+
+/**
+ * @brief Returns the index of the stash FIFO of an EVENT
+ */
+static int mailboxFifoOf(int event) {
+    return (event >= 0 && event < MAILBOX_MAX_EVENTS) ? event : MAILBOX_MAX_EVENTS;
+}
+
+static MailboxNode * mailboxNodeNew(Mailbox * this) {
+    MailboxNode * node = this->freeNodes;
+    if (node != NULL) {
+        this->freeNodes = node->next;
+    } else {
+        node = (MailboxNode *) malloc(sizeof(MailboxNode) + this->mqSize);
+        STOP_ON_ERROR(node == NULL, "Error during memory allocation of a mailbox node : ")
+    }
+    return node;
+}
+
+static void mailboxNodeFree(Mailbox * this, MailboxNode * node) {
+    node->next = this->freeNodes;
+    this->freeNodes = node;
+}
+
+/**
+ * @brief Takes an empty segment of the node from the shared pool, or allocates one
+ */
+static MailboxChunk * mailboxChunkNew(int node) {
+    int stack = node + 1;
+    pthread_mutex_lock(&mailboxChunkMutex);
+    MailboxChunk * chunk = mailboxFreeChunks[stack];
+    if (chunk != NULL) {
+        mailboxFreeChunks[stack] = chunk->next;
+        mailboxFreeChunkCount[stack]--;
+    }
+    pthread_mutex_unlock(&mailboxChunkMutex);
+
+    if (chunk == NULL) {
+        chunk = (MailboxChunk *) numaAlloc(MAILBOX_CHUNK_BYTES, node);
+    }
+    chunk->next = NULL;
+    chunk->head = 0;
+    chunk->tail = 0;
+    return chunk;
+}
+
+/**
+ * @brief Gives a drained segment of the node back to the shared pool, or to the system if the pool is full
+ */
+static void mailboxChunkFree(MailboxChunk * chunk, int node) {
+    int stack = node + 1;
+    pthread_mutex_lock(&mailboxChunkMutex);
+    if (mailboxFreeChunkCount[stack] < MAILBOX_CHUNK_POOL_SIZE) {
+        chunk->next = mailboxFreeChunks[stack];
+        mailboxFreeChunks[stack] = chunk;
+        mailboxFreeChunkCount[stack]++;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&mailboxChunkMutex);
+    numaFree(chunk);
+}
+
+/**
+ * @brief Appends a message to the spill. Called with the spill mutex locked.
+ */
+static void mailboxSpillPush(Mailbox * this, const char * frame) {
+    if (this->spillTail == NULL || this->spillTail->tail == this->chunkCapacity) {
+        MailboxChunk * chunk = mailboxChunkNew(this->node);
+        if (this->spillTail == NULL) {
+            this->spillHead = chunk;
         } else {
-            TRACE("ERROR : mq_unlink failed (exiting)\n");
-            exit(EXIT_FAILURE);
+            this->spillTail->next = chunk;
         }
+        this->spillTail = chunk;
+    }
+    memcpy(this->spillTail->frames + this->spillTail->tail * this->mqMsgSize, frame, this->mqMsgSize);
+    this->spillTail->tail++;
+    __atomic_add_fetch(&this->spilled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Removes the oldest spilled message. Called by the consumer when spilled is not 0.
+ */
+static void mailboxSpillPop(Mailbox * this, char * frame) {
+    pthread_mutex_lock(&this->spillMutex);
+    MailboxChunk * chunk = this->spillHead;
+    memcpy(frame, chunk->frames + chunk->head * this->mqMsgSize, this->mqMsgSize);
+    chunk->head++;
+    if (chunk->head == chunk->tail) { // Drained : the segment is given back
+        this->spillHead = chunk->next;
+        if (this->spillHead == NULL) {
+            this->spillTail = NULL;
+        }
+        mailboxChunkFree(chunk, this->node);
+    }
+    __atomic_sub_fetch(&this->spilled, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&this->spillCond);
+    pthread_mutex_unlock(&this->spillMutex);
+}
+
+/**
+ * @brief Sends a message to the queue, or spills it if the queue is full
+ *
+ * Once a message is spilled, the following ones are spilled too until the
+ * spill is drained, so that the messages of a producer keep their order.
+ *
+ * @param deadline absolute CLOCK_REALTIME time after which the send is given up, NULL to wait forever
+ * @param limit number of spilled messages above which the send waits
+ * @retval -1 With errno set to ETIMEDOUT if the spill was still full at the deadline, or to the error of mq_timedsend
+ */
+static int mailboxSpillPost(Mailbox * this, const char * frame, const struct timespec * deadline, long limit) {
+    // Usual case : nothing spilled and room in the queue
+    if (__atomic_load_n(&this->spilled, __ATOMIC_ACQUIRE) == 0) {
+        errno = 0;
+        if (mq_timedsend(this->mq, frame, this->mqMsgSize, 0, &mailboxExpired) == 0) {
+            return 0;
+        } else if (errno != ETIMEDOUT) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&this->spillMutex);
+    while (this->spilled >= limit) {
+        int err = (deadline == NULL) ? pthread_cond_wait(&this->spillCond, &this->spillMutex)
+                                     : pthread_cond_timedwait(&this->spillCond, &this->spillMutex, deadline);
+        if (err == ETIMEDOUT) {
+            pthread_mutex_unlock(&this->spillMutex);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    if (this->spilled == 0) { // The consumer may have drained the queue meanwhile
+        errno = 0;
+        if (mq_timedsend(this->mq, frame, this->mqMsgSize, 0, &mailboxExpired) == 0) {
+            pthread_mutex_unlock(&this->spillMutex);
+            return 0;
+        } else if (errno != ETIMEDOUT) {
+            pthread_mutex_unlock(&this->spillMutex);
+            return -1;
+        }
+    }
+    mailboxSpillPush(this, frame);
+    int first = (this->spilled == 1);
+    pthread_mutex_unlock(&this->spillMutex);
+
+    if (first) {
+        // The consumer may be waiting on a queue emptied since it was found full.
+        // If the queue is full again, the consumer is not waiting : the wake up is not needed.
+        mq_timedsend(this->mq, frame, this->mqMsgSize, MAILBOX_WAKE_PRIORITY, &mailboxExpired);
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a message at the end of the FIFO of its EVENT
+ */
+static void mailboxStashPush(Mailbox * this, MailboxNode * node) {
+    int fifo = mailboxFifoOf(mailboxEventOf(node->msg));
+    node->next = NULL;
+    if (this->stash[fifo].tail == NULL) {
+        this->stash[fifo].head = node;
+    } else {
+        this->stash[fifo].tail->next = node;
+    }
+    this->stash[fifo].tail = node;
+    this->stashMask |= (1ULL << fifo);
+    __atomic_add_fetch(&this->stashCount, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Removes the oldest stashed message among the FIFOs of mask
+ *
+ * Only the heads of the FIFOs are compared, so the cost does not depend
+ * on the number of stashed messages.
+ *
+ * @retval NULL if no FIFO of mask has a message
+ */
+static MailboxNode * mailboxStashPop(Mailbox * this, uint64_t mask) {
+    uint64_t candidates = this->stashMask & mask;
+    int oldest = -1;
+
+    while (candidates != 0) {
+        int fifo = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+        if (oldest == -1 || this->stash[fifo].head->seq < this->stash[oldest].head->seq) {
+            oldest = fifo;
+        }
+    }
+    if (oldest == -1) {
+        return NULL;
+    }
+
+    MailboxNode * node = this->stash[oldest].head;
+    this->stash[oldest].head = node->next;
+    if (node->next == NULL) {
+        this->stash[oldest].tail = NULL;
+        this->stashMask &= ~(1ULL << oldest);
+    }
+    __atomic_sub_fetch(&this->stashCount, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+/**
+ * @brief Puts a message back in the FIFO of its EVENT, at the place of its arrival order
+ */
+static void mailboxStashInsert(Mailbox * this, MailboxNode * node) {
+    int fifo = mailboxFifoOf(mailboxEventOf(node->msg));
+    MailboxNode ** link = &this->stash[fifo].head;
+
+    while (*link != NULL && (*link)->seq < node->seq) {
+        link = &(*link)->next;
+    }
+    node->next = *link;
+    *link = node;
+    if (node->next == NULL) {
+        this->stash[fifo].tail = node;
     }
+    this->stashMask |= (1ULL << fifo);
+    __atomic_add_fetch(&this->stashCount, 1, __ATOMIC_RELAXED);
+}
 
-    /* Creating and opening the mailbox */
+/**
+ * @brief Initializes the queue
+ */
+extern Mailbox * mailboxInit(char * objName, int objCounter, __syscall_slong_t maxMsgSize) {
+    return mailboxCreate(objName, objCounter, maxMsgSize, NULL, NUMA_NO_NODE);
+}
+
+/**
+ * @brief Puts a message of the journal back in the mailbox
+ */
+static void mailboxReplay(void * caller, uint64_t seq, const void * data, uint32_t length) {
+    Mailbox * this = caller;
+    if (length != this->mqSize) {
+        TRACE("[MAILBOX] Message %lu of the journal has a wrong size (ignored)\n", (unsigned long) seq)
+        return;
+    }
+    MailboxNode * node = mailboxNodeNew(this);
+    memcpy(node->msg, data, length);
+    node->seq = ++this->pullSeq;
+    node->journalSeq = seq;
+    this->maxJournalSeq = seq;
+    mailboxStashPush(this, node);
+}
+
+/**
+ * @brief Initializes a durable queue, and replays the messages of the journal not acknowledged yet
+ */
+extern Mailbox * mailboxInitDurable(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal) {
+    return mailboxInitPlaced(objName, objCounter, maxMsgSize, journal, NUMA_NO_NODE);
+}
+
+/**
+ * @brief Initializes a queue on a node, durable if journal is not NULL
+ */
+extern Mailbox * mailboxInitPlaced(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal,
+                                   int node) {
+    Mailbox * this = mailboxCreate(objName, objCounter, maxMsgSize, journal, node);
+    if (journal == NULL) {
+        return this;
+    }
+    uint64_t acked = journalGetAcked(journal);
+    this->maxJournalSeq = acked;
+    long count = journalReplay(journal, acked, &mailboxReplay, this);
+    TRACE("[MAILBOX] %ld messages of the journal replayed in %s\n", count, this->queueName)
+    return this;
+}
+
+/**
+ * @brief Initializes the queue, durable if journal is not NULL
+ *
+ * @param node node of the mailbox and of the segments of its spill, NUMA_NO_NODE if it is not placed
+ */
+static Mailbox * mailboxCreate(char * objName, int objCounter, __syscall_slong_t maxMsgSize, Journal * journal,
+                               int node) {
+    Mailbox * this = (Mailbox *) numaAlloc(sizeof(Mailbox), node);
+    int length = snprintf(this->queueName, SIZE_BOX_NAME, NAME_MQ_BOX, objName, objCounter);
+    if (length < 0 || length >= SIZE_BOX_NAME) {
+        TRACE("ERROR : mailbox name too long (exiting)\n");
+        exit(EXIT_FAILURE);
+    }
+    this->objCounter = objCounter;
+    this->traceId = __atomic_add_fetch(&mailboxCounter, 1, __ATOMIC_RELAXED);
+    this->sendSeq = 0;
+    this->posted = 0;
+    this->pulled = 0;
+    this->creditsEnabled = 0;
+    this->credits = 0;
+    memset(this->stash, 0, sizeof(this->stash));
+    this->stashMask = 0;
+    this->stashCount = 0;
+    this->pullSeq = 0;
+    this->freeNodes = NULL;
+    this->lastSeq = 0;
+    this->deferred.head = NULL;
+    this->deferred.tail = NULL;
+    this->deferredCount = 0;
+    this->journal = journal;
+    this->mqMsgSize = maxMsgSize + sizeof(uint64_t) + ((journal != NULL) ? sizeof(uint64_t) : 0);
+    pthread_mutex_init(&this->journalMutex, NULL);
+    this->pullJournalSeq = 0;
+    this->lastJournalSeq = 0;
+    this->maxJournalSeq = 0;
+    pthread_mutex_init(&this->spillMutex, NULL);
+    pthread_cond_init(&this->spillCond, NULL);
+    this->spillHead = NULL;
+    this->spillTail = NULL;
+    this->spilled = 0;
+    this->chunkCapacity = (MAILBOX_CHUNK_BYTES - sizeof(MailboxChunk)) / this->mqMsgSize;
+    this->node = (node >= 0 && node < NUMA_MAX_NODES) ? node : NUMA_NO_NODE;
+    this->spillLimit = (this->chunkCapacity > 0) ? MAILBOX_SPILL_LIMIT : 0; // No spill for the huge messages
+
+    TRACE("[MAILBOX] Defined the Queue name : %s\n", this->queueName)
+
+    TRACE("[MAILBOX] Oppening the mailbox %s\n", this->queueName)
 
     /* Initializes the queue attributes */
     struct mq_attr attr;
     attr.mq_flags = 0;
     attr.mq_maxmsg = MQ_MAX_MESSAGES;		// Size of the queue
-    attr.mq_msgsize = maxMsgSize;		// Max size of a message
+    attr.mq_msgsize = this->mqMsgSize;		// Max size of a message
     attr.mq_curmsgs = 0;
 
-    // Creating the queue
+    // Creating the queue. A queue left by a previous run is destroyed, which is
+    // the rare case : the name is only unlinked when it already exists.
     this->mqSize = maxMsgSize;
     errno = 0;
-    this->mq = mq_open(this->queueName, O_CREAT | O_RDWR, 0600, &attr); // 600 = rw for owner and nothing else
+    this->mq = mq_open(this->queueName, O_CREAT | O_EXCL | O_RDWR, 0600, &attr); // 600 = rw for owner and nothing else
+    if (this->mq == -1 && errno == EEXIST) {
+        TRACE("[MAILBOX] Destroying the previous mailbox %s\n", this->queueName)
+        errno = 0;
+        if (mq_unlink(this->queueName) == -1 && errno != ENOENT) {
+            TRACE("ERROR : mq_unlink failed (exiting)\n");
+            exit(EXIT_FAILURE);
+        }
+        this->mq = mq_open(this->queueName, O_CREAT | O_EXCL | O_RDWR, 0600, &attr);
+    }
     if(this->mq == -1){
         TRACE("ERROR : mq_open failed (exiting)\n");
         exit(EXIT_FAILURE);
@@ -90,7 +546,34 @@ extern void mailboxClose(Mailbox * this) {
             exit(EXIT_FAILURE);
         }
     }
-    free(this);
+
+    /* Destruction of the stashed messages */
+    MailboxNode * node;
+    mailboxRecall(this);
+    while ((node = mailboxStashPop(this, ~0ULL)) != NULL) {
+        mailboxNodeFree(this, node);
+    }
+    while (this->freeNodes != NULL) {
+        node = this->freeNodes;
+        this->freeNodes = node->next;
+        free(node);
+    }
+    while (this->spillHead != NULL) {
+        MailboxChunk * chunk = this->spillHead;
+        this->spillHead = chunk->next;
+        mailboxChunkFree(chunk, this->node);
+    }
+    pthread_mutex_destroy(&this->journalMutex);
+    pthread_mutex_destroy(&this->spillMutex);
+    pthread_cond_destroy(&this->spillCond);
+    numaFree(this);
+}
+
+/**
+ * @brief Sets the hard cap of the spill of the queue
+ */
+extern void mailboxSetSpillLimit(Mailbox * this, long limit) {
+    this->spillLimit = (this->chunkCapacity > 0 && limit > 0) ? limit : 0;
 }
 
 /**
@@ -100,9 +583,85 @@ extern void mailboxClose(Mailbox * this) {
  * @param msg message
  */
 extern void mailboxSendMsg(Mailbox * this, char * msg) {
+    if (this->creditsEnabled) { // The credits may become negative : the producers that check them will wait
+        __atomic_sub_fetch(&this->credits, 1, __ATOMIC_ACQ_REL);
+    }
+    mailboxPost(this, msg);
+}
+
+/**
+ * @brief Sends a message to the queue without ever blocking
+ */
+extern void mailboxSendMsgUnbounded(Mailbox * this, char * msg) {
+    if (this->creditsEnabled) {
+        __atomic_sub_fetch(&this->credits, 1, __ATOMIC_ACQ_REL);
+    }
+    mailboxTimedPost(this, msg, 0, NULL, POST_JOURNALED | POST_UNBOUNDED);
+}
+
+/**
+ * @brief Sends a message to the queue, without taking a credit
+ */
+static void mailboxPost(Mailbox * this, char * msg) {
+    mailboxTimedPost(this, msg, 0, NULL, POST_JOURNALED);
+}
+
+/**
+ * @brief Sends a message to the queue, without taking a credit
+ *
+ * The identifier of its trace flow is sent after the message, so that the
+ * receive is linked to its send whatever the order of the producers and the
+ * priorities. In durable mode, the message is appended to the journal and its
+ * number in the journal follows. The journal lock is kept until the message is
+ * in the queue, so that the journal and the queue have the same order.
+ *
+ * @param deadline absolute CLOCK_REALTIME time after which the send is given up, NULL to wait forever
+ * @param flags POST_JOURNALED, POST_UNBOUNDED or 0
+ * @retval -1 If the queue was still full at the deadline
+ */
+static int mailboxTimedPost(Mailbox * this, char * msg, unsigned int priority, const struct timespec * deadline,
+                            int flags) {
+    int journaled = (flags & POST_JOURNALED);
+    uint64_t start = tracerNow();
+    char frame[this->mqMsgSize];
+    uint64_t flowId = 0; // No flow when the tracer is disabled
+
+    if (start != 0) {
+        flowId = FLOW_ID(this, __atomic_add_fetch(&this->sendSeq, 1, __ATOMIC_RELAXED));
+    }
+    memcpy(frame, msg, this->mqSize);
+    memcpy(frame + FRAME_FLOW(this), &flowId, sizeof(uint64_t));
+    if (this->journal != NULL) {
+        uint64_t journalSeq = 0;
+        if (journaled) {
+            pthread_mutex_lock(&this->journalMutex);
+            journalSeq = journalAppend(this->journal, msg, this->mqSize);
+            if (journalSeq == 0) {
+                TRACE("ERROR : journalAppend failed -> the message is not durable (continue)\n");
+            }
+        }
+        memcpy(frame + FRAME_JOURNAL_SEQ(this), &journalSeq, sizeof(uint64_t));
+    }
+
     errno = 0;
-    ssize_t err = mq_send(this->mq, msg, this->mqSize, 0);
+    int err;
+    if (priority == 0 && (flags & POST_UNBOUNDED) && this->chunkCapacity > 0) {
+        err = mailboxSpillPost(this, frame, deadline, LONG_MAX);
+    } else if (priority == 0 && this->spillLimit > 0) {
+        err = mailboxSpillPost(this, frame, deadline, this->spillLimit);
+    } else if (deadline == NULL) {
+        err = mq_send(this->mq, frame, this->mqMsgSize, priority);
+    } else {
+        err = mq_timedsend(this->mq, frame, this->mqMsgSize, priority, deadline);
+    }
+    if (this->journal != NULL && journaled) {
+        pthread_mutex_unlock(&this->journalMutex);
+    }
     if(err == -1){
+        if (errno == ETIMEDOUT) {
+            TRACE("[MAILBOX] The mailbox %s is still full at the deadline\n", this->queueName)
+            return -1;
+        }
         if(errno == EAGAIN){
             TRACE("ERROR : mq_send failed -> the queue is full (exiting)\n");
         }else if (errno == EMSGSIZE){
@@ -115,7 +674,10 @@ extern void mailboxSendMsg(Mailbox * this, char * msg) {
         exit(EXIT_FAILURE);
     }else{
         TRACE("[MAILBOX] Sending message to the mailbox %s\n", this->queueName)
+        __atomic_add_fetch(&this->posted, 1, __ATOMIC_RELEASE);
+        tracerFlow("mailboxSendMsg", start, flowId, 0, this->traceId);
     }
+    return 0;
 }
 
 /**
@@ -126,7 +688,25 @@ extern void mailboxSendMsg(Mailbox * this, char * msg) {
  */
 extern void mailboxSendStop(Mailbox * this, char * msg) {
     TRACE("[MAILBOX] Sending stop event to the queue %s\n", this->queueName)
-    mailboxSendMsg(this, msg);
+    if (this->creditsEnabled) {
+        __atomic_sub_fetch(&this->credits, 1, __ATOMIC_ACQ_REL);
+    }
+    // Not journaled : a durable object must not be stopped again when its journal is replayed
+    mailboxTimedPost(this, msg, 0, NULL, 0);
+}
+
+/**
+ * @brief Sends a stop EVENT to the queue, before a deadline
+ */
+extern int mailboxTimedSendStop(Mailbox * this, char * msg, int urgent, const struct timespec * deadline) {
+    TRACE("[MAILBOX] Sending %s stop event to the queue %s\n", urgent ? "urgent" : "last", this->queueName)
+    if (mailboxTimedPost(this, msg, urgent ? MAILBOX_URGENT_PRIORITY : 0, deadline, 0) == -1) {
+        return -1;
+    }
+    if (this->creditsEnabled) {
+        __atomic_sub_fetch(&this->credits, 1, __ATOMIC_ACQ_REL);
+    }
+    return 0;
 }
 
 /**
@@ -136,10 +716,164 @@ extern void mailboxSendStop(Mailbox * this, char * msg) {
  * @param wrapper address of a message buffer
  */
 extern void mailboxReceive(Mailbox * this, char * msg) {
-    errno = 0;
-    ssize_t err = mq_receive(this->mq, msg, this->mqSize, 0);
+    // The stashed messages arrived before the ones still in the queue
+    MailboxNode * node = mailboxStashPop(this, ~0ULL);
+    if (node != NULL) {
+        memcpy(msg, node->msg, this->mqSize);
+        this->lastSeq = node->seq;
+        this->lastJournalSeq = node->journalSeq;
+        mailboxNodeFree(this, node);
+        return;
+    }
+    mailboxPull(this, msg);
+    this->lastSeq = this->pullSeq;
+    this->lastJournalSeq = this->pullJournalSeq;
+}
+
+/**
+ * @brief Receives a message from the queue if there is one
+ */
+extern int mailboxTryReceive(Mailbox * this, char * msg) {
+    MailboxNode * node = mailboxStashPop(this, ~0ULL);
+    if (node != NULL) {
+        memcpy(msg, node->msg, this->mqSize);
+        this->lastSeq = node->seq;
+        this->lastJournalSeq = node->journalSeq;
+        mailboxNodeFree(this, node);
+        return 0;
+    }
+
+    // Every message sent so far has been taken : the queue is empty, without asking the kernel
+    if (__atomic_load_n(&this->posted, __ATOMIC_ACQUIRE) == this->pulled) {
+        return -1;
+    }
+    if (mailboxTimedPull(this, msg, &mailboxExpired) == -1) {
+        return -1;
+    }
+    this->lastSeq = this->pullSeq;
+    this->lastJournalSeq = this->pullJournalSeq;
+    return 0;
+}
+
+/**
+ * @brief Receives the oldest message whose EVENT is in the mask
+ */
+extern void mailboxReceiveMatching(Mailbox * this, uint32_t eventMask, char * msg) {
+    MailboxNode * node = mailboxStashPop(this, eventMask);
+
+    while (node == NULL) {
+        node = mailboxNodeNew(this);
+        mailboxPull(this, node->msg);
+        node->seq = this->pullSeq;
+        node->journalSeq = this->pullJournalSeq;
+
+        if ((MAILBOX_EVENT_MASK(mailboxEventOf(node->msg)) & eventMask) == 0) {
+            TRACE("[MAILBOX] Message of EVENT %d stashed in %s\n", mailboxEventOf(node->msg), this->queueName)
+            mailboxStashPush(this, node);
+            node = NULL;
+        }
+    }
+
+    memcpy(msg, node->msg, this->mqSize);
+    this->lastSeq = node->seq;
+    this->lastJournalSeq = node->journalSeq;
+    mailboxNodeFree(this, node);
+}
+
+/**
+ * @brief Defers the last received message until the next mailboxRecall
+ */
+extern int mailboxDefer(Mailbox * this, char * msg) {
+    if (this->deferredCount >= MAILBOX_DEFER_LIMIT) {
+        TRACE("[MAILBOX] Too many deferred messages in %s\n", this->queueName)
+        return -1;
+    }
+    MailboxNode * node = mailboxNodeNew(this);
+    memcpy(node->msg, msg, this->mqSize);
+    node->seq = this->lastSeq;
+    node->journalSeq = this->lastJournalSeq;
+    node->next = NULL;
+
+    if (this->deferred.tail == NULL) {
+        this->deferred.head = node;
+    } else {
+        this->deferred.tail->next = node;
+    }
+    this->deferred.tail = node;
+    this->deferredCount++;
+    __atomic_add_fetch(&this->stashCount, 1, __ATOMIC_RELAXED);
+    TRACE("[MAILBOX] Message of EVENT %d deferred in %s\n", mailboxEventOf(msg), this->queueName)
+    return 0;
+}
+
+/**
+ * @brief Returns non zero if mailboxDefer() can keep another message
+ */
+extern int mailboxCanDefer(Mailbox * this) {
+    return this->deferredCount < MAILBOX_DEFER_LIMIT;
+}
+
+/**
+ * @brief Makes the deferred messages receivable again, before the newer ones
+ */
+extern void mailboxRecall(Mailbox * this) {
+    MailboxNode * node = this->deferred.head;
+
+    while (node != NULL) {
+        MailboxNode * next = node->next;
+        __atomic_sub_fetch(&this->stashCount, 1, __ATOMIC_RELAXED);
+        mailboxStashInsert(this, node);
+        node = next;
+    }
+    if (this->deferredCount > 0) {
+        TRACE("[MAILBOX] %ld deferred messages recalled in %s\n", this->deferredCount, this->queueName)
+    }
+    this->deferred.head = NULL;
+    this->deferred.tail = NULL;
+    this->deferredCount = 0;
+}
+
+/**
+ * @brief Takes the next message out of the queue
+ *
+ * @note This function is blocking if the queue is empty
+ */
+static void mailboxPull(Mailbox * this, char * msg) {
+    mailboxTimedPull(this, msg, NULL);
+}
+
+/**
+ * @brief Takes the next message out of the queue, waiting at most until the deadline
+ *
+ * @param deadline absolute CLOCK_REALTIME deadline, NULL to wait without limit
+ * @retval 0 If a message has been received
+ * @retval -1 If the deadline expired before a message arrived
+ */
+static int mailboxTimedPull(Mailbox * this, char * msg, const struct timespec * deadline) {
+    uint64_t start = tracerNow();
+    char frame[this->mqMsgSize];
+    unsigned int priority;
+    ssize_t err;
+    do {
+        errno = 0;
+        priority = 0;
+        if (__atomic_load_n(&this->spilled, __ATOMIC_ACQUIRE) > 0) {
+            // The messages of the queue were sent before the spilled ones
+            err = mq_timedreceive(this->mq, frame, this->mqMsgSize, &priority, &mailboxExpired);
+            if (err == -1 && errno == ETIMEDOUT) {
+                mailboxSpillPop(this, frame);
+                err = 0;
+            }
+        } else if (deadline == NULL) {
+            err = mq_receive(this->mq, frame, this->mqMsgSize, &priority);
+        } else {
+            err = mq_timedreceive(this->mq, frame, this->mqMsgSize, &priority, deadline);
+        }
+    } while (err != -1 && priority == MAILBOX_WAKE_PRIORITY);
     if(err == -1) {
-        if (errno == EMSGSIZE) {
+        if (errno == ETIMEDOUT) {
+            return -1;
+        } else if (errno == EMSGSIZE) {
             TRACE("ERROR : mq_receive failed -> msg length is less than the mq_msgsize attribute of the queue (exiting)\n");
         } else if (errno == EBADF) {
             TRACE("ERROR : mq_receive failed -> wrong mq given or mq or not opened for reading (exiting)\n");
@@ -149,5 +883,236 @@ extern void mailboxReceive(Mailbox * this, char * msg) {
         exit((EXIT_FAILURE));
     }else {
         TRACE("[MAILBOX] Receiving a message from %s\n", this->queueName)
+        uint64_t flowId;
+        memcpy(&flowId, frame + FRAME_FLOW(this), sizeof(uint64_t));
+        if (flowId != 0) {
+            tracerFlow("mailboxReceive", start, flowId, 1, this->traceId);
+        } else { // Sent while the tracer was disabled
+            tracerSlice("mailbox", "mailboxReceive", start, "mailbox", this->traceId);
+        }
+        this->pullSeq++;
+        this->pulled++;
+        memcpy(msg, frame, this->mqSize);
+        if (this->journal != NULL) {
+            memcpy(&this->pullJournalSeq, frame + FRAME_JOURNAL_SEQ(this), sizeof(uint64_t));
+            if (this->pullJournalSeq > this->maxJournalSeq) {
+                this->maxJournalSeq = this->pullJournalSeq;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the number of messages currently waiting in the queue
+ */
+extern int mailboxGetCounter(Mailbox * this) {
+    return this->objCounter;
+}
+
+extern long mailboxGetCount(Mailbox * this) {
+    struct mq_attr attr;
+    errno = 0;
+    int err = mq_getattr(this->mq, &attr);
+    if (err == -1) {
+        TRACE("ERROR : mq_getattr failed -> wrong mq descriptor (continue)\n");
+        return -1;
+    }
+    return attr.mq_curmsgs + __atomic_load_n(&this->spilled, __ATOMIC_RELAXED)
+           + __atomic_load_n(&this->stashCount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Enables the credit based flow control of the queue
+ */
+extern void mailboxEnableCredits(Mailbox * this, int credits) {
+    // The messages already in the queue (replayed from the journal) will be granted back once handled
+    long pending = mailboxGetCount(this);
+    __atomic_store_n(&this->credits, credits - (int) max(pending, 0), __ATOMIC_RELEASE);
+    this->creditsEnabled = 1;
+}
+
+/**
+ * @brief Returns the number of messages that can be sent without blocking
+ */
+extern int mailboxGetCredits(Mailbox * this) {
+    if (!this->creditsEnabled) {
+        return MQ_MAX_MESSAGES;
+    }
+    return __atomic_load_n(&this->credits, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Gives credits back to the producers. Called by the consumer.
+ */
+extern void mailboxGrantCredits(Mailbox * this, int credits) {
+    if (this->creditsEnabled) {
+        __atomic_add_fetch(&this->credits, credits, __ATOMIC_ACQ_REL);
+    }
+}
+
+/**
+ * @brief Sends a message to the queue if a credit is available
+ */
+extern int mailboxTrySendMsg(Mailbox * this, char * msg) {
+    if (this->creditsEnabled) {
+        int credits = __atomic_load_n(&this->credits, __ATOMIC_ACQUIRE);
+        do {
+            if (credits <= 0) {
+                TRACE("[MAILBOX] No credit left on the mailbox %s\n", this->queueName)
+                return -1;
+            }
+        } while (!__atomic_compare_exchange_n(&this->credits, &credits, credits - 1, 0,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    }
+    mailboxPost(this, msg);
+    return 0;
+}
+
+/**
+ * @brief Acknowledges the handled messages in the journal of a durable mailbox
+ *
+ * The messages still stashed or deferred are not handled yet : the
+ * acknowledgement stops before the oldest of them.
+ */
+extern void mailboxAck(Mailbox * this) {
+    if (this->journal == NULL) {
+        return;
+    }
+    uint64_t acked = this->maxJournalSeq;
+    uint64_t mask = this->stashMask;
+    while (mask != 0) { // The FIFOs are in arrival order : only their heads are looked at
+        int fifo = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        for (MailboxNode * node = this->stash[fifo].head; node != NULL; node = node->next) {
+            if (node->journalSeq != 0) {
+                if (node->journalSeq <= acked) {
+                    acked = node->journalSeq - 1;
+                }
+                break;
+            }
+        }
+    }
+    for (MailboxNode * node = this->deferred.head; node != NULL; node = node->next) {
+        if (node->journalSeq != 0 && node->journalSeq <= acked) {
+            acked = node->journalSeq - 1;
+        }
+    }
+    journalAck(this->journal, acked);
+}
+
+
+/*----------------------- MAILBOX POOL -----------------------*/
+
+static void * mailboxPoolFillSlice(void * arg) {
+    MailboxPoolSlice * slice = arg;
+    for (int i = 0; i < slice->count; i++) {
+        slice->mailboxes[i] = mailboxInit(slice->pool->objName, slice->firstCounter + i,
+                                          slice->pool->maxMsgSize);
     }
-}
\ No newline at end of file
+    return NULL;
+}
+
+extern MailboxPool * mailboxPoolNew(char * objName, __syscall_slong_t maxMsgSize) {
+    MailboxPool * this = (MailboxPool *) malloc(sizeof(MailboxPool));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the mailbox pool : ")
+    snprintf(this->objName, SIZE_BOX_NAME, "%s", objName);
+    this->maxMsgSize = maxMsgSize;
+    this->mailboxes = NULL;
+    this->count = 0;
+    this->capacity = 0;
+    pthread_mutex_init(&this->mutex, NULL);
+    return this;
+}
+
+/**
+ * @brief Creates mailboxes in the pool, in parallel
+ *
+ * The mailboxes are created outside of the lock, so the pool can still be
+ * used while it is filled.
+ */
+extern void mailboxPoolFill(MailboxPool * this, int firstCounter, int count) {
+    if (count <= 0) {
+        return;
+    }
+    Mailbox ** created = (Mailbox **) malloc(count * sizeof(Mailbox *));
+    STOP_ON_ERROR(created == NULL, "Error during memory allocation of the mailbox pool : ")
+
+    long nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nbThreads > count / MAILBOX_POOL_MIN_PER_THREAD) {
+        nbThreads = count / MAILBOX_POOL_MIN_PER_THREAD;
+    }
+    if (nbThreads < 1) {
+        nbThreads = 1;
+    }
+
+    MailboxPoolSlice * slices = (MailboxPoolSlice *) malloc(nbThreads * sizeof(MailboxPoolSlice));
+    pthread_t * threads = (pthread_t *) malloc(nbThreads * sizeof(pthread_t));
+    STOP_ON_ERROR(slices == NULL || threads == NULL, "Error during memory allocation of the mailbox pool : ")
+    int done = 0;
+    for (long t = 0; t < nbThreads; t++) {
+        int size = (count - done) / (int) (nbThreads - t);
+        slices[t] = (MailboxPoolSlice) {
+            .pool = this,
+            .mailboxes = created + done,
+            .firstCounter = firstCounter + done,
+            .count = size
+        };
+        done += size;
+        // The first slice is done by the calling thread
+        if (t > 0 && pthread_create(&threads[t], NULL, &mailboxPoolFillSlice, &slices[t]) != 0) {
+            TRACE("ERROR : pthread_create failed, the slice is created by the caller (continue)\n");
+            mailboxPoolFillSlice(&slices[t]);
+            slices[t].pool = NULL;
+        }
+    }
+    mailboxPoolFillSlice(&slices[0]);
+    for (long t = 1; t < nbThreads; t++) {
+        if (slices[t].pool != NULL) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    free(slices);
+    free(threads);
+
+    pthread_mutex_lock(&this->mutex);
+    if (this->count + count > this->capacity) {
+        int capacity = this->count + count;
+        Mailbox ** mailboxes = (Mailbox **) realloc(this->mailboxes, capacity * sizeof(Mailbox *));
+        STOP_ON_ERROR(mailboxes == NULL, "Error during memory allocation of the mailbox pool : ")
+        this->mailboxes = mailboxes;
+        this->capacity = capacity;
+    }
+    memcpy(this->mailboxes + this->count, created, count * sizeof(Mailbox *));
+    this->count += count;
+    pthread_mutex_unlock(&this->mutex);
+
+    free(created);
+    TRACE("[MAILBOX] %d mailboxes created in the pool %s with %ld threads\n", count, this->objName, nbThreads)
+}
+
+extern Mailbox * mailboxPoolTake(MailboxPool * this) {
+    Mailbox * mailbox = NULL;
+    pthread_mutex_lock(&this->mutex);
+    if (this->count > 0) {
+        mailbox = this->mailboxes[--this->count];
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return mailbox;
+}
+
+extern int mailboxPoolGetCount(MailboxPool * this) {
+    pthread_mutex_lock(&this->mutex);
+    int count = this->count;
+    pthread_mutex_unlock(&this->mutex);
+    return count;
+}
+
+extern void mailboxPoolFree(MailboxPool * this) {
+    for (int i = 0; i < this->count; i++) {
+        mailboxClose(this->mailboxes[i]);
+    }
+    pthread_mutex_destroy(&this->mutex);
+    free(this->mailboxes);
+    free(this);
+}
@@ -0,0 +1,151 @@
+/**
+ * @file numa.c
+ *
+ * @brief NUMA functions that find the node of the CPUs and allocate memory
+ * on a given node
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "util.h"
+#include "numa.h"
+
+
+/**
+ * @def Directory of a CPU in sysfs : it holds a nodeN link to its node
+ */
+#define NUMA_CPU_PATH "/sys/devices/system/cpu/cpu%d"
+
+/**
+ * @def Number of bits of a word of a node mask
+ */
+#define NUMA_MASK_BITS (8 * sizeof(unsigned long))
+
+/**
+ * @brief Node of each CPU, read once by numaDiscover()
+ */
+static int numaCpuNodes[CPU_SETSIZE];
+static int numaNodeCount = 1;
+static pthread_once_t numaOnce = PTHREAD_ONCE_INIT;
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void numaDiscover(void) {
+    long nbCpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (nbCpus <= 0 || nbCpus > CPU_SETSIZE) {
+        nbCpus = CPU_SETSIZE;
+    }
+
+    for (int cpu = 0; cpu < nbCpus; cpu++) {
+        char path[sizeof(NUMA_CPU_PATH) + 16];
+        snprintf(path, sizeof(path), NUMA_CPU_PATH, cpu);
+        DIR * dir = opendir(path);
+        if (dir == NULL) { // Not a CPU of the machine, or no sysfs
+            continue;
+        }
+        struct dirent * entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int node;
+            if (sscanf(entry->d_name, "node%d", &node) == 1 && node >= 0 && node < NUMA_MAX_NODES) {
+                numaCpuNodes[cpu] = node;
+                if (node >= numaNodeCount) {
+                    numaNodeCount = node + 1;
+                }
+                break;
+            }
+        }
+        closedir(dir);
+    }
+    TRACE("[NUMA] %d nodes\n", numaNodeCount)
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+int numaGetNodeCount(void) {
+    pthread_once(&numaOnce, &numaDiscover);
+    return numaNodeCount;
+}
+
+
+int numaGetNodeOfCpu(int cpu) {
+    pthread_once(&numaOnce, &numaDiscover);
+    return (cpu >= 0 && cpu < CPU_SETSIZE) ? numaCpuNodes[cpu] : 0;
+}
+
+
+int numaGetNodeOfCpuSet(const cpu_set_t * cpus) {
+    int counts[NUMA_MAX_NODES] = { 0 };
+    int best = NUMA_NO_NODE;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus)) {
+            int node = numaGetNodeOfCpu(cpu);
+            counts[node]++;
+            if (best == NUMA_NO_NODE || counts[node] > counts[best]) {
+                best = node;
+            }
+        }
+    }
+    return best;
+}
+
+
+int numaGetCurrentNode(void) {
+    int cpu = sched_getcpu();
+    return (cpu >= 0) ? numaGetNodeOfCpu(cpu) : NUMA_NO_NODE;
+}
+
+
+void * numaAlloc(size_t size, int node) {
+    char * block;
+    size_t length = 0; // Length of the mapping, 0 if the memory comes from malloc
+
+    if (node < 0 || node >= NUMA_MAX_NODES || numaGetNodeCount() <= 1) {
+        block = (char *) malloc(NUMA_HEADER_SIZE + size);
+        STOP_ON_ERROR(block == NULL, "Error during memory allocation : ")
+    } else {
+        long page = sysconf(_SC_PAGESIZE);
+        length = (NUMA_HEADER_SIZE + size + page - 1) / page * page;
+        block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        STOP_ON_ERROR(block == MAP_FAILED, "Error during memory mapping on a node : ")
+
+        // Set before the pages are touched : they are allocated on the node at their first access
+        unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_BITS] = { 0 };
+        mask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+        if (syscall(SYS_mbind, block, length, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, 0) == -1) {
+            TRACE("[NUMA] mbind failed : the memory is placed by its first access (continue)\n")
+        }
+    }
+    memcpy(block, &length, sizeof(size_t));
+    return block + NUMA_HEADER_SIZE;
+}
+
+
+void numaFree(void * ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    char * block = (char *) ptr - NUMA_HEADER_SIZE;
+    size_t length;
+    memcpy(&length, block, sizeof(size_t));
+    if (length == 0) {
+        free(block);
+    } else {
+        munmap(block, length);
+    }
+}
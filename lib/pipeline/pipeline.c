@@ -0,0 +1,264 @@
+/**
+ * @file pipeline.c
+ *
+ * @brief Pipeline class that chains processing stages, handing the message
+ * buffers from one stage to the next without copying them
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+
+#include "util.h"
+#include "tracer.h"
+#include "pipeline.h"
+
+
+/**
+ * @def Size of a cache line : the buffers start on their own lines
+ */
+#define PIPELINE_CACHE_LINE (64)
+
+/**
+ * @brief Single producer single consumer link between two threads
+ *
+ * The link can hold all the buffers and the stop marker, so it is never
+ * full : the producer never waits.
+ */
+typedef struct {
+    void ** slots;
+    uint32_t mask;
+    uint32_t head __attribute__((aligned(PIPELINE_CACHE_LINE)));  ///< Only used by the consumer
+    uint32_t tail __attribute__((aligned(PIPELINE_CACHE_LINE)));  ///< Only used by the producer
+    sem_t items;        ///< Buffers in the link
+} PipelineLink;
+
+typedef struct {
+    PipelineHandler handler;
+    void * caller;
+    const char * name;
+    int fused;
+} PipelineStage;
+
+/**
+ * @brief Thread that runs a stage and the stages fused with it
+ */
+typedef struct {
+    Pipeline * pipeline;
+    uint32_t first;     ///< First stage of the thread
+    uint32_t last;      ///< Last stage of the thread, included
+    PipelineLink input;
+    pthread_t thread;
+} PipelineWorker;
+
+struct pipeline_t {
+    char * buffers;
+    size_t bufferSize;  ///< Size of a buffer, rounded up to a cache line
+    uint32_t nbBuffers;
+
+    /* Pool of the free buffers */
+    void ** freeBuffers;
+    uint32_t freeCount;
+    pthread_mutex_t freeMutex;
+    sem_t freeSem;
+
+    PipelineStage stages[PIPELINE_MAX_STAGES];
+    uint32_t nbStages;
+    PipelineWorker * workers;
+    uint32_t nbWorkers;
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void pipelineLinkInit(PipelineLink * link, uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    link->slots = (void **) malloc(size * sizeof(void *));
+    STOP_ON_ERROR(link->slots == NULL, "Error during memory allocation of a pipeline link : ")
+    link->mask = size - 1;
+    link->head = 0;
+    link->tail = 0;
+    sem_init(&link->items, 0, 0);
+}
+
+/**
+ * @brief Hands a buffer to the consumer of the link. Called by the producer only.
+ */
+static void pipelineLinkPush(PipelineLink * link, void * buffer) {
+    link->slots[link->tail & link->mask] = buffer;
+    link->tail++;
+    sem_post(&link->items); // Publishes the slot to the consumer
+}
+
+/**
+ * @brief Takes the next buffer of the link. Called by the consumer only.
+ *
+ * @note This function is blocking if the link is empty
+ */
+static void * pipelineLinkPop(PipelineLink * link) {
+    while (sem_wait(&link->items) == -1 && errno == EINTR) {
+    }
+    void * buffer = link->slots[link->head & link->mask];
+    link->head++;
+    return buffer;
+}
+
+static void pipelineLinkDestroy(PipelineLink * link) {
+    sem_destroy(&link->items);
+    free(link->slots);
+}
+
+static void pipelineRelease(Pipeline * this, void * buffer) {
+    pthread_mutex_lock(&this->freeMutex);
+    this->freeBuffers[this->freeCount++] = buffer;
+    pthread_mutex_unlock(&this->freeMutex);
+    sem_post(&this->freeSem);
+}
+
+static void * pipelineRun(void * arg) {
+    PipelineWorker * worker = arg;
+    Pipeline * this = worker->pipeline;
+    PipelineLink * output = (worker + 1 < this->workers + this->nbWorkers) ? &(worker + 1)->input : NULL;
+    int64_t seq = 0;
+
+    tracerNameThread(this->stages[worker->first].name);
+    for (;;) {
+        void * buffer = pipelineLinkPop(&worker->input);
+        if (buffer == NULL) { // Stop marker : the previous buffers have been handled
+            if (output != NULL) {
+                pipelineLinkPush(output, NULL);
+            }
+            break;
+        }
+
+        int result = PIPELINE_FORWARD;
+        for (uint32_t i = worker->first; i <= worker->last && result == PIPELINE_FORWARD; i++) {
+            uint64_t start = tracerNow();
+            result = this->stages[i].handler(this->stages[i].caller, buffer);
+            tracerSlice("pipeline", this->stages[i].name, start, "seq", seq);
+        }
+        seq++;
+
+        if (result == PIPELINE_FORWARD && output != NULL) {
+            pipelineLinkPush(output, buffer);
+        } else {
+            pipelineRelease(this, buffer);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+Pipeline * pipelineNew(size_t bufferSize, uint32_t nbBuffers) {
+    STOP_ON_ERROR(nbBuffers == 0, "Wrong number of pipeline buffers\n")
+
+    Pipeline * this = (Pipeline *) calloc(1, sizeof(Pipeline));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the pipeline : ")
+    this->bufferSize = (bufferSize + PIPELINE_CACHE_LINE - 1) / PIPELINE_CACHE_LINE * PIPELINE_CACHE_LINE;
+    this->nbBuffers = nbBuffers;
+
+    int err = posix_memalign((void **) &this->buffers, PIPELINE_CACHE_LINE, this->bufferSize * nbBuffers);
+    STOP_ON_ERROR(err != 0, "Error during memory allocation of the pipeline buffers")
+    this->freeBuffers = (void **) malloc(nbBuffers * sizeof(void *));
+    STOP_ON_ERROR(this->freeBuffers == NULL, "Error during memory allocation of the pipeline pool : ")
+    for (uint32_t i = 0; i < nbBuffers; i++) {
+        this->freeBuffers[i] = this->buffers + (size_t) (nbBuffers - 1 - i) * this->bufferSize;
+    }
+    this->freeCount = nbBuffers;
+    pthread_mutex_init(&this->freeMutex, NULL);
+    sem_init(&this->freeSem, 0, nbBuffers);
+    return this;
+}
+
+
+void pipelineAddStage(Pipeline * this, PipelineHandler handler, void * caller, const char * name, int fused) {
+    STOP_ON_ERROR(this->nbStages == PIPELINE_MAX_STAGES, "Too many pipeline stages\n")
+    STOP_ON_ERROR(this->workers != NULL, "Pipeline stage added after pipelineStart()\n")
+
+    PipelineStage * stage = &this->stages[this->nbStages++];
+    stage->handler = handler;
+    stage->caller = caller;
+    stage->name = name;
+    stage->fused = fused && this->nbStages > 1; // The first stage has its own thread
+}
+
+
+void pipelineStart(Pipeline * this) {
+    STOP_ON_ERROR(this->nbStages == 0, "Pipeline started without stage\n")
+
+    for (uint32_t i = 0; i < this->nbStages; i++) {
+        this->nbWorkers += !this->stages[i].fused;
+    }
+    this->workers = (PipelineWorker *) calloc(this->nbWorkers, sizeof(PipelineWorker));
+    STOP_ON_ERROR(this->workers == NULL, "Error during memory allocation of the pipeline workers : ")
+
+    PipelineWorker * worker = this->workers - 1;
+    for (uint32_t i = 0; i < this->nbStages; i++) {
+        if (!this->stages[i].fused) {
+            worker++;
+            worker->pipeline = this;
+            worker->first = i;
+            pipelineLinkInit(&worker->input, this->nbBuffers + 1); // + 1 for the stop marker
+        }
+        worker->last = i;
+    }
+
+    for (uint32_t i = 0; i < this->nbWorkers; i++) {
+        int err = pthread_create(&this->workers[i].thread, NULL, &pipelineRun, &this->workers[i]);
+        STOP_ON_ERROR(err != 0, "Error when creating a pipeline thread")
+    }
+    TRACE("[PIPELINE] %u stages started on %u threads\n", this->nbStages, this->nbWorkers)
+}
+
+
+void * pipelineAcquire(Pipeline * this) {
+    while (sem_wait(&this->freeSem) == -1 && errno == EINTR) {
+    }
+    pthread_mutex_lock(&this->freeMutex);
+    void * buffer = this->freeBuffers[--this->freeCount];
+    pthread_mutex_unlock(&this->freeMutex);
+    return buffer;
+}
+
+
+void pipelinePush(Pipeline * this, void * buffer) {
+    pipelineLinkPush(&this->workers[0].input, buffer);
+}
+
+
+void pipelineStop(Pipeline * this) {
+    if (this->workers == NULL) {
+        return;
+    }
+    pipelineLinkPush(&this->workers[0].input, NULL);
+    for (uint32_t i = 0; i < this->nbWorkers; i++) {
+        pthread_join(this->workers[i].thread, NULL);
+        pipelineLinkDestroy(&this->workers[i].input);
+    }
+    free(this->workers);
+    this->workers = NULL;
+    this->nbWorkers = 0;
+}
+
+
+void pipelineFree(Pipeline * this) {
+    pthread_mutex_destroy(&this->freeMutex);
+    sem_destroy(&this->freeSem);
+    free(this->freeBuffers);
+    free(this->buffers);
+    free(this);
+}
@@ -0,0 +1,248 @@
+/**
+ * @file request.c
+ *
+ * @brief Request class that allows an active object to ask another one for
+ * a result without blocking its thread
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <time.h>
+
+#include "request.h"
+
+
+/**
+ * @def Maximum number of pending requests of a table
+ */
+#define MAX_REQUESTS (0xFFFF)
+
+/**
+ * @brief Slot of the table, reused by successive requests
+ */
+typedef struct {
+    RequestId id;           ///< Id of the current request of the slot
+    int pending;            ///< The current request waits for its reply
+    uint64_t deadline;      ///< Monotonic deadline of the current request, in milliseconds (0 if none)
+} RequestSlot;
+
+struct requests_t {
+    RequestSlot * slots;
+    uint32_t capacity;
+    uint32_t next;          ///< Next slot to look at when opening a request
+    uint16_t generation;    ///< Distinguishes the successive requests of a slot
+    RequestCallback callback;
+    void * caller;
+    pthread_mutex_t mutex;
+
+    /* Timeouts : the callbacks of the expired requests are called by the thread of the table,
+     * which is joined by requestsFree(), so that no callback runs once the table is freed */
+    pthread_t timer;        ///< Started with the first request that has a deadline
+    int timerStarted;
+    int closing;            ///< Set by requestsFree() to stop the thread
+    pthread_cond_t timerCond; ///< A deadline has been added, or the table is freed
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static uint64_t requestNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Returns the slot of a pending request, or NULL. Must be called with the mutex locked.
+ */
+static RequestSlot * requestFind(Requests * this, RequestId id) {
+    uint32_t index = id & 0xFFFF;
+    if (index >= this->capacity) {
+        return NULL;
+    }
+    RequestSlot * slot = &this->slots[index];
+    return (slot->pending && slot->id == id) ? slot : NULL;
+}
+
+/**
+ * @brief Ends the request of the slot. Must be called with the mutex locked.
+ */
+static void requestClose(RequestSlot * slot) {
+    slot->pending = 0;
+    slot->deadline = 0;
+}
+
+/**
+ * @brief Finishes the first expired request, if any, with REQUEST_TIMEOUT. Must be called with the mutex locked.
+ *
+ * @param next set to the earliest deadline still to come, 0 if none
+ * @retval 1 If a request has expired : the mutex has been released meanwhile
+ */
+static int requestExpire(Requests * this, uint64_t * next) {
+    uint64_t now = requestNow();
+    *next = 0;
+
+    for (uint32_t i = 0; i < this->capacity; i++) {
+        RequestSlot * slot = &this->slots[i];
+        if (!slot->pending || slot->deadline == 0) {
+            continue;
+        }
+        if (slot->deadline <= now) {
+            RequestId id = slot->id;
+            requestClose(slot);
+            pthread_mutex_unlock(&this->mutex);
+
+            TRACE("[REQUEST] Request %u timed out\n", id)
+            this->callback(this->caller, id, REQUEST_TIMEOUT, 0);
+            pthread_mutex_lock(&this->mutex);
+            return 1;
+        }
+        if (*next == 0 || slot->deadline < *next) {
+            *next = slot->deadline;
+        }
+    }
+    return 0;
+}
+
+static void * requestTimerRun(void * arg) {
+    Requests * this = arg;
+
+    pthread_mutex_lock(&this->mutex);
+    while (!this->closing) {
+        uint64_t next;
+        if (requestExpire(this, &next)) {
+            continue; // The slots may have changed while the callback ran
+        }
+        if (next == 0) {
+            pthread_cond_wait(&this->timerCond, &this->mutex);
+        } else {
+            struct timespec deadline = {
+                .tv_sec = (time_t) (next / 1000),
+                .tv_nsec = (long) (next % 1000) * 1000000
+            };
+            pthread_cond_timedwait(&this->timerCond, &this->mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+Requests * requestsNew(uint32_t capacity, RequestCallback callback, void * caller) {
+    STOP_ON_ERROR(capacity == 0 || capacity > MAX_REQUESTS, "Wrong capacity of the requests table\n")
+
+    Requests * this = (Requests *) malloc(sizeof(Requests));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the requests table : ")
+    this->slots = (RequestSlot *) calloc(capacity, sizeof(RequestSlot));
+    STOP_ON_ERROR(this->slots == NULL, "Error during memory allocation of the requests slots : ")
+
+    this->capacity = capacity;
+    this->next = 0;
+    this->generation = 0;
+    this->callback = callback;
+    this->caller = caller;
+    pthread_mutex_init(&this->mutex, NULL);
+
+    // The deadlines are monotonic
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&this->timerCond, &attr);
+    pthread_condattr_destroy(&attr);
+    this->timerStarted = 0;
+    this->closing = 0;
+
+    return this;
+}
+
+
+RequestId requestOpen(Requests * this, uint32_t timeout) {
+    RequestId id = 0;
+
+    pthread_mutex_lock(&this->mutex);
+    for (uint32_t n = 0; n < this->capacity; n++) {
+        uint32_t index = (this->next + n) % this->capacity;
+        RequestSlot * slot = &this->slots[index];
+        if (slot->pending) {
+            continue;
+        }
+
+        this->generation++;
+        if (this->generation == 0) { // The id is never 0
+            this->generation = 1;
+        }
+        id = ((RequestId) this->generation << 16) | index;
+        slot->id = id;
+        slot->pending = 1;
+        this->next = (index + 1) % this->capacity;
+
+        if (timeout > 0) {
+            if (!this->timerStarted) {
+                int err = pthread_create(&this->timer, NULL, &requestTimerRun, this);
+                STOP_ON_ERROR(err != 0, "Error when creating the requests timeout thread")
+                this->timerStarted = (err == 0);
+            }
+            slot->deadline = requestNow() + timeout;
+            pthread_cond_signal(&this->timerCond);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    ERROR(id == 0, "Too many pending requests (%u)\n", this->capacity)
+    return id;
+}
+
+
+int requestReply(Requests * this, RequestId id, intptr_t result) {
+    pthread_mutex_lock(&this->mutex);
+    RequestSlot * slot = requestFind(this, id);
+    if (slot == NULL) {
+        pthread_mutex_unlock(&this->mutex);
+        TRACE("[REQUEST] Late reply to the request %u dropped\n", id)
+        return -1;
+    }
+    requestClose(slot);
+    pthread_mutex_unlock(&this->mutex);
+
+    this->callback(this->caller, id, REQUEST_OK, result);
+    return 0;
+}
+
+
+int requestCancel(Requests * this, RequestId id) {
+    pthread_mutex_lock(&this->mutex);
+    RequestSlot * slot = requestFind(this, id);
+    if (slot != NULL) {
+        requestClose(slot);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return (slot != NULL) ? 0 : -1;
+}
+
+
+void requestsFree(Requests * this) {
+    // Once the thread is joined, no timeout callback is running nor will run
+    pthread_mutex_lock(&this->mutex);
+    this->closing = 1;
+    pthread_cond_signal(&this->timerCond);
+    pthread_mutex_unlock(&this->mutex);
+    if (this->timerStarted) {
+        pthread_join(this->timer, NULL);
+    }
+
+    pthread_cond_destroy(&this->timerCond);
+    pthread_mutex_destroy(&this->mutex);
+    free(this->slots);
+    free(this);
+}
@@ -0,0 +1,278 @@
+/**
+ * @file shard.c
+ *
+ * @brief Shard class that spreads the events of one active class over several replicas
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "util.h"
+#include "shard.h"
+
+
+struct shard_t {
+    ShardOps ops;                   ///< Functions of the replicated class
+    void ** replicas;               ///< Replicas, maxReplicas slots
+    int count;                      ///< Number of running replicas
+    int minReplicas;
+    int maxReplicas;
+    long highWatermark;
+    long lowWatermark;
+    pthread_rwlock_t routeLock;     ///< Held for reading while routing, for writing while resizing
+    pthread_mutex_t rebalanceLock;  ///< Only one rebalance at a time
+
+    /* Autoscale */
+    pthread_t autoscaler;           ///< Started by the first shardAutoscale()
+    int autoscaleStarted;
+    int closing;                    ///< Set by shardFree() to stop the thread
+    uint32_t period;                ///< Delay between two rebalances, in milliseconds
+    pthread_mutex_t autoscaleMutex; ///< Protects closing and period
+    pthread_cond_t autoscaleCond;   ///< The period changed, or the shard is freed
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+/**
+ * @brief Jump consistent hash (Lamping & Veach) : only 1/n of the keys
+ * move when going from n-1 to n buckets, and they all move to the new one.
+ */
+static int shardHash(uint64_t key, int buckets) {
+    int64_t b = -1;
+    int64_t j = 0;
+
+    while (j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t) ((b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+    }
+    return (int) b;
+}
+
+/**
+ * @brief Waits until the replica has handled the events it received
+ */
+static void shardSync(Shard * this, void * replica) {
+    if (this->ops.sync != NULL) {
+        this->ops.sync(replica);
+    } else {
+        // Without sync, we can only wait for the mailbox to be empty
+        while (this->ops.pending(replica) > 0) {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * @brief Adds a replica. Must be called with the rebalance lock held.
+ *
+ * The keys that move to the new replica must not have events left in the
+ * other ones : the new replica is routed to at once, but it is only started
+ * once the other ones are synced, its events waiting in its mailbox meanwhile.
+ * The sync is done without the route lock, so that the actions of the
+ * replicas can still route events.
+ */
+static void shardGrow(Shard * this) {
+    void * replica = this->ops.create();
+
+    pthread_rwlock_wrlock(&this->routeLock);
+    int count = this->count;
+    this->replicas[count] = replica;
+    this->count++;
+    pthread_rwlock_unlock(&this->routeLock);
+
+    // Only the rebalance changes the replicas : they can be read without the route lock
+    for (int i = 0; i < count; i++) {
+        shardSync(this, this->replicas[i]);
+    }
+    this->ops.start(replica);
+    TRACE("[SHARD] Replica added (%d replicas)\n", count + 1)
+}
+
+/**
+ * @brief Removes the last replica. Must be called with the route lock held for writing.
+ *
+ * @note The replica is drained with the route lock held : its actions must
+ * not call shardRoute() (see ShardOps.stop)
+ */
+static void shardShrink(Shard * this) {
+    this->count--;
+    void * replica = this->replicas[this->count];
+    this->replicas[this->count] = NULL;
+
+    // Stopping the replica handles its pending events before its keys move
+    this->ops.stop(replica);
+    this->ops.destroy(replica);
+    TRACE("[SHARD] Replica removed (%d replicas)\n", this->count)
+}
+
+/**
+ * @brief Autoscale thread : rebalances the shard every period, until shardFree() joins it
+ */
+static void * shardAutoscaleRun(void * arg) {
+    Shard * this = arg;
+
+    pthread_mutex_lock(&this->autoscaleMutex);
+    while (!this->closing) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += this->period / 1000;
+        deadline.tv_nsec += (long) (this->period % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&this->autoscaleCond, &this->autoscaleMutex, &deadline) == ETIMEDOUT
+            && !this->closing) {
+            pthread_mutex_unlock(&this->autoscaleMutex);
+            shardRebalance(this);
+            pthread_mutex_lock(&this->autoscaleMutex);
+        }
+    }
+    pthread_mutex_unlock(&this->autoscaleMutex);
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+Shard * shardNew(const ShardOps * ops, int minReplicas, int maxReplicas, long highWatermark, long lowWatermark) {
+    STOP_ON_ERROR(minReplicas < 1 || maxReplicas < minReplicas, "Wrong number of replicas\n")
+
+    Shard * this = (Shard *) malloc(sizeof(Shard));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the shard : ")
+    this->replicas = (void **) calloc(maxReplicas, sizeof(void *));
+    STOP_ON_ERROR(this->replicas == NULL, "Error during memory allocation of the replicas : ")
+
+    this->ops = *ops;
+    this->count = 0;
+    this->minReplicas = minReplicas;
+    this->maxReplicas = maxReplicas;
+    this->highWatermark = highWatermark;
+    this->lowWatermark = lowWatermark;
+    this->autoscaleStarted = 0;
+    this->closing = 0;
+    this->period = 0;
+
+    // Writers are preferred, otherwise a busy shard would never be resized
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&this->routeLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&this->rebalanceLock, NULL);
+    pthread_mutex_init(&this->autoscaleMutex, NULL);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&this->autoscaleCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    for (int i = 0; i < minReplicas; i++) {
+        this->replicas[i] = this->ops.create();
+        this->ops.start(this->replicas[i]);
+    }
+    this->count = minReplicas;
+
+    return this;
+}
+
+
+void * shardRoute(Shard * this, uint64_t key) {
+    pthread_rwlock_rdlock(&this->routeLock);
+    return this->replicas[shardHash(key, this->count)];
+}
+
+
+void shardRouteDone(Shard * this) {
+    pthread_rwlock_unlock(&this->routeLock);
+}
+
+
+int shardRebalance(Shard * this) {
+    if (pthread_mutex_trylock(&this->rebalanceLock) != 0) {
+        return shardGetCount(this); // A rebalance is already running
+    }
+
+    pthread_rwlock_rdlock(&this->routeLock);
+    long total = 0;
+    for (int i = 0; i < this->count; i++) {
+        total += max(this->ops.pending(this->replicas[i]), 0L);
+    }
+    long mean = total / this->count;
+    int count = this->count;
+    pthread_rwlock_unlock(&this->routeLock);
+
+    if (mean > this->highWatermark && count < this->maxReplicas) {
+        shardGrow(this);
+    } else if (mean < this->lowWatermark && count > this->minReplicas) {
+        pthread_rwlock_wrlock(&this->routeLock);
+        shardShrink(this);
+        pthread_rwlock_unlock(&this->routeLock);
+    }
+
+    pthread_mutex_unlock(&this->rebalanceLock);
+    return shardGetCount(this);
+}
+
+
+void shardAutoscale(Shard * this, uint32_t period) {
+    pthread_mutex_lock(&this->autoscaleMutex);
+    this->period = period;
+    if (!this->autoscaleStarted) {
+        int err = pthread_create(&this->autoscaler, NULL, &shardAutoscaleRun, this);
+        ERROR(err != 0, "Error when creating the autoscale thread\n")
+        this->autoscaleStarted = (err == 0);
+    } else { // The next rebalance waits for the new period
+        pthread_cond_signal(&this->autoscaleCond);
+    }
+    pthread_mutex_unlock(&this->autoscaleMutex);
+}
+
+
+int shardGetCount(Shard * this) {
+    pthread_rwlock_rdlock(&this->routeLock);
+    int count = this->count;
+    pthread_rwlock_unlock(&this->routeLock);
+    return count;
+}
+
+
+void shardFree(Shard * this) {
+    // Once the thread is joined, no rebalance is running nor will run
+    pthread_mutex_lock(&this->autoscaleMutex);
+    this->closing = 1;
+    pthread_cond_signal(&this->autoscaleCond);
+    pthread_mutex_unlock(&this->autoscaleMutex);
+    if (this->autoscaleStarted) {
+        pthread_join(this->autoscaler, NULL);
+    }
+
+    pthread_mutex_lock(&this->rebalanceLock);
+
+    pthread_rwlock_wrlock(&this->routeLock);
+    for (int i = 0; i < this->count; i++) {
+        this->ops.stop(this->replicas[i]);
+        this->ops.destroy(this->replicas[i]);
+    }
+    this->count = 0;
+    pthread_rwlock_unlock(&this->routeLock);
+
+    pthread_mutex_unlock(&this->rebalanceLock);
+    pthread_rwlock_destroy(&this->routeLock);
+    pthread_mutex_destroy(&this->rebalanceLock);
+    pthread_cond_destroy(&this->autoscaleCond);
+    pthread_mutex_destroy(&this->autoscaleMutex);
+    free(this->replicas);
+    free(this);
+}
@@ -0,0 +1,271 @@
+/**
+ * @file smarray.c
+ *
+ * @brief State machine array class that runs a whole population of small
+ * identical state machines, without a thread nor a mailbox per instance
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include "util.h"
+#include "smarray.h"
+
+
+/**
+ * @def Alignment of the columns, so that the loops work on whole cache lines
+ */
+#define COLUMN_ALIGNMENT (64)
+
+/**
+ * @def Below size / DENSE_RATIO pending events, only the instances that received
+ * an event are stepped. Above, the whole population is stepped in one pass.
+ */
+#define DENSE_RATIO (8)
+
+/**
+ * @def Maximum number of STATEs, EVENTs and ACTIONs (they are stored in one byte)
+ */
+#define MAX_ENUM (256)
+
+
+struct smarray_t {
+    uint32_t size;              ///< Number of state machines
+    uint8_t * states;           ///< Column of the current states
+    uint8_t * events;           ///< Column of the pending events (0 if none)
+    uint8_t * actions;          ///< Column of the ACTIONs triggered by the last step
+    uint32_t * posted;          ///< Instances that received an event since the last step
+    uint32_t postedCount;
+    uint32_t * order;           ///< Instances grouped by ACTION during the dispatch
+
+    uint16_t * table;           ///< Packed transitions : nextState | action << 8
+    uint32_t eventShift;        ///< A row of the packed table has 1 << eventShift entries
+    uint32_t nbEvents;
+
+    uint32_t nbActions;
+    SmArrayAction * actionFns;
+    void * caller;
+
+    uint32_t actionCount[MAX_ENUM];    ///< Number of instances per ACTION during the dispatch
+};
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void * smArrayColumn(uint32_t size, size_t elementSize) {
+    void * column = NULL;
+    size_t bytes = (size * elementSize + COLUMN_ALIGNMENT - 1) & ~((size_t) COLUMN_ALIGNMENT - 1);
+    int err = posix_memalign(&column, COLUMN_ALIGNMENT, max(bytes, (size_t) COLUMN_ALIGNMENT));
+    STOP_ON_ERROR(err != 0, "Error during memory allocation of a state machine array column : ")
+    return (err == 0) ? column : NULL;
+}
+
+/**
+ * @brief Checks that every transition leads to a known STATE and to a known ACTION that has a function
+ *
+ * @retval -1 If a transition is wrong
+ */
+static int smArrayCheckTable(uint32_t nbStates, uint32_t nbEvents, const SmArrayTransition * table,
+                             uint32_t nbActions, const SmArrayAction * actions) {
+    for (uint32_t state = 1; state < nbStates; state++) {
+        for (uint32_t event = 1; event < nbEvents; event++) {
+            SmArrayTransition transition = table[state * nbEvents + event];
+            if (transition.nextState == 0) { // Forgotten event : the action is not used
+                continue;
+            }
+            int wrong = transition.nextState >= nbStates || transition.action >= nbActions
+                        || (transition.action != 0 && actions[transition.action] == NULL);
+            ERROR(wrong, "Wrong transition from the STATE %u on the EVENT %u\n", state, event)
+            if (wrong) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Packs the transition table. The rows are padded to a power of two, so
+ * that a transition is found with a shift and a or, and a forgotten event
+ * becomes a transition to the same state without ACTION, so that the step
+ * loops have no branch.
+ */
+static void smArrayPack(SmArray * this, uint32_t nbStates, uint32_t nbEvents, const SmArrayTransition * table) {
+    this->eventShift = 0;
+    while ((1U << this->eventShift) < nbEvents) {
+        this->eventShift++;
+    }
+    uint32_t rowSize = 1U << this->eventShift;
+
+    this->table = (uint16_t *) smArrayColumn(MAX_ENUM * rowSize, sizeof(uint16_t));
+    for (uint32_t state = 0; state < MAX_ENUM; state++) {
+        for (uint32_t event = 0; event < rowSize; event++) {
+            uint16_t packed = (uint16_t) state; // S_FORGET : stay in the same state, A_NOP
+
+            if (state > 0 && state < nbStates && event > 0 && event < nbEvents) {
+                SmArrayTransition transition = table[state * nbEvents + event];
+                if (transition.nextState != 0) {
+                    packed = (uint16_t) (transition.nextState | (transition.action << 8));
+                }
+            }
+            this->table[(state << this->eventShift) | event] = packed;
+        }
+    }
+}
+
+/**
+ * @brief Groups the instances by ACTION and calls each ACTION function once
+ */
+static void smArrayDispatch(SmArray * this, const uint32_t * indices, uint32_t count, int dense) {
+    uint32_t offset[MAX_ENUM];
+    uint32_t total = 0;
+
+    for (uint32_t a = 0; a < this->nbActions; a++) {
+        offset[a] = total;
+        if (a > 0) { // A_NOP is never dispatched
+            total += this->actionCount[a];
+        }
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t i = dense ? k : indices[k];
+        uint8_t action = this->actions[i];
+        if (action != 0) {
+            this->order[offset[action]++] = i;
+        }
+    }
+
+    for (uint32_t a = 1; a < this->nbActions; a++) {
+        if (this->actionCount[a] > 0) {
+            uint32_t first = offset[a] - this->actionCount[a];
+            this->actionFns[a](this->caller, &this->order[first], this->actionCount[a]);
+        }
+    }
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+SmArray * smArrayNew(uint32_t size, uint32_t nbStates, uint32_t nbEvents, const SmArrayTransition * table,
+                     uint32_t nbActions, const SmArrayAction * actions, uint8_t initialState, void * caller) {
+    STOP_ON_ERROR(nbStates > MAX_ENUM || nbEvents > MAX_ENUM || nbActions > MAX_ENUM,
+                  "A state machine array handles at most %d STATEs, EVENTs and ACTIONs\n", MAX_ENUM)
+    // The columns are indexed by the table : it is checked even without STOP_ON_ERROR
+    int wrong = nbStates > MAX_ENUM || nbEvents > MAX_ENUM || nbActions > MAX_ENUM || nbActions == 0
+                || initialState == 0 || initialState >= nbStates
+                || smArrayCheckTable(nbStates, nbEvents, table, nbActions, actions) == -1;
+    ERROR(wrong, "Wrong transition table or initial STATE of a state machine array\n")
+    if (wrong) {
+        return NULL;
+    }
+
+    SmArray * this = (SmArray *) malloc(sizeof(SmArray));
+    STOP_ON_ERROR(this == NULL, "Error during memory allocation of the state machine array : ")
+
+    this->size = size;
+    this->states = (uint8_t *) smArrayColumn(size, sizeof(uint8_t));
+    this->events = (uint8_t *) smArrayColumn(size, sizeof(uint8_t));
+    this->actions = (uint8_t *) smArrayColumn(size, sizeof(uint8_t));
+    this->posted = (uint32_t *) smArrayColumn(size, sizeof(uint32_t));
+    this->order = (uint32_t *) smArrayColumn(size, sizeof(uint32_t));
+    this->postedCount = 0;
+
+    memset(this->states, initialState, size);
+    memset(this->events, 0, size);
+    memset(this->actions, 0, size);
+
+    smArrayPack(this, nbStates, nbEvents, table);
+    this->nbEvents = nbEvents;
+
+    this->nbActions = nbActions;
+    this->actionFns = (SmArrayAction *) malloc(nbActions * sizeof(SmArrayAction));
+    STOP_ON_ERROR(this->actionFns == NULL, "Error during memory allocation of the state machine array actions : ")
+    memcpy(this->actionFns, actions, nbActions * sizeof(SmArrayAction));
+    this->caller = caller;
+
+    return this;
+}
+
+
+int smArrayPost(SmArray * this, uint32_t index, uint8_t event) {
+    if (index >= this->size || event >= this->nbEvents) {
+        return -1;
+    }
+    if (event == 0) { // E_NOP
+        return 0;
+    }
+    if (this->events[index] != 0) {
+        return -1;
+    }
+    this->events[index] = event;
+    this->posted[this->postedCount++] = index;
+    return 0;
+}
+
+
+uint32_t smArrayStep(SmArray * this) {
+    uint32_t count = this->postedCount;
+    if (count == 0) {
+        return 0;
+    }
+
+    uint8_t * restrict states = this->states;
+    uint8_t * restrict events = this->events;
+    uint8_t * restrict actions = this->actions;
+    const uint16_t * restrict table = this->table;
+    const uint32_t shift = this->eventShift;
+    int dense = (count >= this->size / DENSE_RATIO);
+
+    if (dense) {
+        // The instances without event go through the E_NOP column, which keeps their state
+        for (uint32_t i = 0; i < this->size; i++) {
+            uint16_t packed = table[((uint32_t) states[i] << shift) | events[i]];
+            states[i] = (uint8_t) packed;
+            actions[i] = (uint8_t) (packed >> 8);
+            events[i] = 0;
+        }
+    } else {
+        const uint32_t * restrict posted = this->posted;
+        for (uint32_t k = 0; k < count; k++) {
+            uint32_t i = posted[k];
+            uint16_t packed = table[((uint32_t) states[i] << shift) | events[i]];
+            states[i] = (uint8_t) packed;
+            actions[i] = (uint8_t) (packed >> 8);
+            events[i] = 0;
+        }
+    }
+
+    memset(this->actionCount, 0, sizeof(this->actionCount));
+    uint32_t scanned = dense ? this->size : count;
+    for (uint32_t k = 0; k < scanned; k++) {
+        this->actionCount[actions[dense ? k : this->posted[k]]]++;
+    }
+
+    // The ACTIONs may post new events : they start a new list
+    this->postedCount = 0;
+    smArrayDispatch(this, this->posted, scanned, dense);
+
+    return count;
+}
+
+
+uint8_t smArrayGetState(SmArray * this, uint32_t index) {
+    return this->states[index];
+}
+
+
+void smArrayFree(SmArray * this) {
+    free(this->states);
+    free(this->events);
+    free(this->actions);
+    free(this->posted);
+    free(this->order);
+    free(this->table);
+    free(this->actionFns);
+    free(this);
+}
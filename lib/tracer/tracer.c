@@ -0,0 +1,322 @@
+/**
+ * @file tracer.c
+ *
+ * @brief Tracer class that records the timeline of the active objects
+ * in memory and exports it as a Chrome trace JSON file
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "util.h"
+#include "tracer.h"
+
+
+/**
+ * @brief Kind of a recorded event
+ */
+typedef enum {
+    T_SLICE,        ///< Slice of a thread (Chrome "X" event)
+    T_INSTANT,      ///< Instant event of a thread (Chrome "i" event)
+    T_FLOW_START,   ///< Slice that starts a message flow (Chrome "X" + "s" events)
+    T_FLOW_END      ///< Slice that ends a message flow (Chrome "X" + "f" events)
+} TracerKind;
+
+/**
+ * @brief Event stored in the buffer
+ */
+typedef struct {
+    uint64_t ts;            ///< Start of the event, in nanoseconds
+    uint64_t dur;           ///< Duration of the event, in nanoseconds
+    uint64_t flowId;        ///< Identifier of the flow, if any
+    const char * cat;       ///< Category of the event
+    const char * name;      ///< Name of the event
+    const char * argName;   ///< Name of the argument
+    int64_t arg;            ///< Value of the argument
+    uint32_t tid;           ///< Thread that recorded the event
+    TracerKind kind;        ///< Kind of the event
+    int ready;              ///< Set once the event is completely written
+} TracerEvent;
+
+/**
+ * @brief Name of a thread
+ */
+typedef struct {
+    uint32_t tid;
+    char name[TRACER_THREAD_NAME_LENGTH];
+} TracerThread;
+
+/**
+ * @brief Path of the file written by the signal thread
+ */
+typedef struct {
+    int signo;
+    const char * path;
+} TracerSignal;
+
+
+static TracerEvent * events = NULL;     ///< Events buffer
+static uint32_t eventsCapacity = 0;     ///< Size of the events buffer
+static uint32_t eventsCount = 0;        ///< Number of reserved events (including the dropped ones)
+static int enabled = 0;                 ///< Recording flag
+
+static TracerThread threads[TRACER_MAX_THREADS];
+static uint32_t threadsCount = 0;
+
+static pthread_mutex_t dumpMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread uint32_t myTid = 0;     ///< Cached kernel identifier of the calling thread
+
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static uint32_t tracerTid(void) {
+    if (myTid == 0) {
+        myTid = (uint32_t) syscall(SYS_gettid);
+    }
+    return myTid;
+}
+
+static uint64_t tracerClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief Reserves an event in the buffer
+ *
+ * @retval NULL if the tracer is disabled or the buffer is full
+ */
+static TracerEvent * tracerReserve(void) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    uint32_t slot = __atomic_fetch_add(&eventsCount, 1, __ATOMIC_RELAXED);
+    if (slot >= eventsCapacity) {
+        return NULL;
+    }
+    return &events[slot];
+}
+
+static void tracerCommit(TracerEvent * event) {
+    event->tid = tracerTid();
+    __atomic_store_n(&event->ready, 1, __ATOMIC_RELEASE);
+}
+
+static void tracerPrintEvent(FILE * file, int pid, const TracerEvent * event) {
+    double ts = event->ts / 1000.0;
+    double dur = event->dur / 1000.0;
+
+    if (event->kind == T_INSTANT) {
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                      "\"pid\":%d,\"tid\":%u,\"args\":{\"%s\":%lld}}",
+                event->name, event->cat, ts, pid, event->tid, event->argName, (long long) event->arg);
+        return;
+    }
+
+    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                  "\"pid\":%d,\"tid\":%u,\"args\":{\"%s\":%lld}}",
+            event->name, event->cat, ts, dur, pid, event->tid, event->argName, (long long) event->arg);
+
+    if (event->kind == T_FLOW_START) {
+        fprintf(file, ",\n{\"name\":\"message\",\"cat\":\"%s\",\"ph\":\"s\",\"id\":\"0x%llx\",\"ts\":%.3f,"
+                      "\"pid\":%d,\"tid\":%u}",
+                event->cat, (unsigned long long) event->flowId, ts, pid, event->tid);
+    } else if (event->kind == T_FLOW_END) {
+        fprintf(file, ",\n{\"name\":\"message\",\"cat\":\"%s\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,"
+                      "\"pid\":%d,\"tid\":%u}",
+                event->cat, (unsigned long long) event->flowId, ts + dur, pid, event->tid);
+    }
+}
+
+/**
+ * @brief Writes a string as a JSON string, escaping the quotes, the backslashes and the control characters
+ */
+static void tracerPrintString(FILE * file, const char * string) {
+    fputc('"', file);
+    for (const unsigned char * c = (const unsigned char *) string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void * tracerSignalRun(TracerSignal * this) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, this->signo);
+
+    while (1) {
+        int signo;
+        if (sigwait(&set, &signo) == 0) {
+            TRACE("[TRACER] Signal %d received, writing %s\n", signo, this->path)
+            tracerDump(this->path);
+        }
+    }
+    return NULL;
+}
+
+
+/*----------------------- PUBLIC FUNCTIONS -----------------------*/
+
+void tracerEnable(uint32_t capacity) {
+    if (events == NULL) {
+        events = (TracerEvent *) calloc(capacity, sizeof(TracerEvent));
+        STOP_ON_ERROR(events == NULL, "Error during memory allocation of the tracer buffer : ")
+        eventsCapacity = capacity;
+    }
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+}
+
+
+void tracerDisable(void) {
+    __atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+}
+
+
+uint64_t tracerNow(void) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return tracerClock();
+}
+
+
+void tracerNameThread(const char * name) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    uint32_t slot = __atomic_fetch_add(&threadsCount, 1, __ATOMIC_RELAXED);
+    if (slot < TRACER_MAX_THREADS) {
+        snprintf(threads[slot].name, TRACER_THREAD_NAME_LENGTH, "%s", name);
+        __atomic_store_n(&threads[slot].tid, tracerTid(), __ATOMIC_RELEASE);
+    }
+}
+
+
+void tracerSlice(const char * cat, const char * name, uint64_t start, const char * argName, int64_t arg) {
+    TracerEvent * event = tracerReserve();
+    if (event != NULL && start != 0) {
+        event->ts = start;
+        event->dur = tracerClock() - start;
+        event->cat = cat;
+        event->name = name;
+        event->argName = argName;
+        event->arg = arg;
+        event->kind = T_SLICE;
+        tracerCommit(event);
+    }
+}
+
+
+void tracerFlow(const char * name, uint64_t start, uint64_t flowId, int isEnd, int64_t mailboxId) {
+    TracerEvent * event = tracerReserve();
+    if (event != NULL && start != 0) {
+        event->ts = start;
+        event->dur = tracerClock() - start;
+        event->flowId = flowId;
+        event->cat = "mailbox";
+        event->name = name;
+        event->argName = "mailbox";
+        event->arg = mailboxId;
+        event->kind = isEnd ? T_FLOW_END : T_FLOW_START;
+        tracerCommit(event);
+    }
+}
+
+
+void tracerInstant(const char * cat, const char * name, const char * argName, int64_t arg) {
+    TracerEvent * event = tracerReserve();
+    if (event != NULL) {
+        event->ts = tracerClock();
+        event->cat = cat;
+        event->name = name;
+        event->argName = argName;
+        event->arg = arg;
+        event->kind = T_INSTANT;
+        tracerCommit(event);
+    }
+}
+
+
+int tracerDump(const char * path) {
+    FILE * file = fopen(path, "w");
+    ERROR(file == NULL, "Error when opening the trace file %s\n", path)
+    if (file == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dumpMutex);
+
+    int pid = (int) getpid();
+    uint32_t count = min(__atomic_load_n(&eventsCount, __ATOMIC_ACQUIRE), eventsCapacity);
+    uint32_t dropped = __atomic_load_n(&eventsCount, __ATOMIC_RELAXED) - count;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":%u},\"traceEvents\":[\n", dropped);
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"active objects\"}}", pid);
+
+    uint32_t nbThreads = min(__atomic_load_n(&threadsCount, __ATOMIC_ACQUIRE), (uint32_t) TRACER_MAX_THREADS);
+    for (uint32_t i = 0; i < nbThreads; i++) {
+        uint32_t tid = __atomic_load_n(&threads[i].tid, __ATOMIC_ACQUIRE);
+        if (tid != 0) {
+            // The names are given by the application : they may hold characters to escape
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                    pid, tid);
+            tracerPrintString(file, threads[i].name);
+            fprintf(file, "}}");
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (__atomic_load_n(&events[i].ready, __ATOMIC_ACQUIRE)) { // Events still being written are skipped
+            tracerPrintEvent(file, pid, &events[i]);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    pthread_mutex_unlock(&dumpMutex);
+
+    int err = fclose(file);
+    ERROR(err != 0, "Error when closing the trace file %s\n", path)
+    TRACE("[TRACER] %u events written in %s (%u dropped)\n", count, path, dropped)
+
+    return (err == 0) ? 0 : -1;
+}
+
+
+void tracerDumpOnSignal(int signo, const char * path) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, signo);
+    int err = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    STOP_ON_ERROR(err != 0, "Error when blocking the trace signal")
+
+    TracerSignal * signalInfo = (TracerSignal *) malloc(sizeof(TracerSignal));
+    STOP_ON_ERROR(signalInfo == NULL, "Error during memory allocation of the trace signal : ")
+    signalInfo->signo = signo;
+    signalInfo->path = path;
+
+    pthread_t threadId;
+    err = pthread_create(&threadId, NULL, (void *) tracerSignalRun, signalInfo);
+    STOP_ON_ERROR(err != 0, "Error when creating the trace signal thread")
+    pthread_detach(threadId);
+}
@@ -47,6 +47,7 @@
 
 #include "util.h"
 #include "watchdog.h"
+#include "tracer.h"
 
 
 /**
@@ -58,6 +59,7 @@ static void mainHandler (union sigval handlerParam)
 {
     Watchdog *theWatchdog = handlerParam.sival_ptr; // Getting the timer reference
 
+    tracerInstant("watchdog", "WatchdogExpiry", "delay", theWatchdog->myDelay);
     theWatchdog->myCallback(theWatchdog, theWatchdog->caller); // Calling the callback function
 }
 
@@ -12,8 +12,22 @@
  * @copyright CCBY 4.0
  */
 
+#ifndef _GNU_SOURCE // Already defined by the Makefile
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <asyncio.h>
+#include <budget.h>
+#include <checkpoint.h>
+#include <coroutine.h>
 #include <mailbox.h>
+#include <numa.h>
+#include <request.h>
+#include <tracer.h>
 
 #include "util.h"
 #include "example.h"
@@ -23,6 +37,48 @@
  */
 static int exampleCounter = 0;
 
+/**
+ * @brief Mailboxes created in advance by ExampleWarmUp()
+ */
+static MailboxPool * examplePool = NULL;
+
+/**
+ * @brief Snapshots of the Examples, enabled by ExampleEnableCheckpoint()
+ */
+static Checkpoint * exampleCheckpoint = NULL;
+
+/**
+ * @def Size of the variables of an Example saved in the checkpoint file
+ */
+#define CHECKPOINT_SLOT_SIZE 128
+
+/**
+ * @def Version of the saved variables. To increase when they, the STATEs or the ACTIONs change.
+ */
+#define CHECKPOINT_LAYOUT 2
+
+/**
+ * @def Budget of the ACTIONs missing in actionBudget, in microseconds
+ */
+#define DEFAULT_ACTION_BUDGET 1000
+
+/**
+ * @def Delay between two looks of the budget monitor at the running ACTIONs, in milliseconds
+ */
+#define BUDGET_MONITOR_PERIOD 10
+
+/**
+ * @brief Monitor of the ACTIONs of all the Examples, created with the first Example and freed with the last one
+ */
+static BudgetMonitor * exampleMonitor = NULL;
+static int exampleMonitorUsers = 0;
+static pthread_mutex_t exampleMonitorMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @def Minimum number of Examples constructed by each thread of ExampleNewFleet()
+ */
+#define FLEET_MIN_PER_THREAD 16
+
 /* ----------------------- MAILBOX DEFINITIONS -----------------------*/
 
 /**
@@ -36,6 +92,26 @@ static int exampleCounter = 0;
  */
 #define SIZE_TASK_NAME 20
 
+/**
+ * @def Maximum number of requests an Example can wait for at the same time
+ */
+#define MAX_PENDING_REQUESTS 16
+
+/**
+ * @def Delay after which a request without reply times out, in milliseconds
+ */
+#define REQUEST_TIMEOUT_DELAY 1000
+
+/**
+ * @def Number of steps of the long ACTION example, the run loop looks at the mailbox between two steps
+ */
+#define LONG_ACTION_STEPS 3
+
+/**
+ * @def Size of the buffer filled by the asynchronous reads
+ */
+#define IO_BUFFER_SIZE 256
+
 
 /*----------------------- TYPE DEFINITIONS -----------------------*/
 
@@ -44,6 +120,7 @@ static int exampleCounter = 0;
  */
 ENUM_DECL(STATE,
     S_FORGET,      ///< Nothing happens
+    S_DEFER,       ///< The EVENT is kept until the next change of STATE, e.g. [S_IDLE][E_EXAMPLE2] = {S_DEFER, A_NOP}
     S_IDLE,        ///< Idle STATE
     S_RUNNING,     ///< Running STATE
     S_DEATH        ///< Transition STATE for stopping the STATE machine
@@ -58,6 +135,10 @@ ENUM_DECL(ACTION,
     A_EXAMPLE1_FROM_RUNNING,    ///< ACTION called when passing from the running STATE to the example1 STATE
     A_EXAMPLE1_FROM_IDLE,       ///< ACTION called when passing from the idle STATE to the running STATE
     A_EXAMPLE2,                 ///< ACTION called when the Example2 EVENT happens
+    A_ANSWER,                   ///< ACTION called when another Example asks for a result
+    A_REPLY,                    ///< ACTION called when the result of a request arrives
+    A_READ,                     ///< ACTION called to start an asynchronous read
+    A_IO_DONE,                  ///< ACTION called when an asynchronous read is over
     A_KILL                      ///< Kills the STATE machine
 )
 
@@ -69,6 +150,11 @@ ENUM_DECL(EVENT,
     E_NOP,      ///< Do nothing
     E_EXAMPLE1, ///< EVENT example 1
     E_EXAMPLE2, ///< EVENT example 2
+    E_ASK,      ///< Another Example asks for a result
+    E_REPLY,    ///< Result (or timeout) of a request of this Example
+    E_READ,     ///< Starts an asynchronous read
+    E_IO_DONE,  ///< An asynchronous read is over
+    E_SYNC,     ///< Wakes up the caller of ExampleSync
     E_KILL     ///< Kills the STATE machine
 )
 
@@ -91,6 +177,9 @@ typedef struct {
     // TODO : Add here the parameters you want to be able to send through the mailbox. Do not remove the EVENT parameter.
     int param;  ///< Example of a possible parameter
     int param2; ///< Example of an other parameter
+
+    Requests * replyTo;   ///< Requests table of the asking Example (E_ASK)
+    RequestId requestId;  ///< Correlation id of the request (E_ASK, E_REPLY)
 } Msg;
 
 /**
@@ -107,6 +196,23 @@ struct Example_t {
     Msg msg;            ///< Structure used to pass parameters to the functions pointer.
     char nameTask[SIZE_TASK_NAME]; ///< Name of the task
     Mailbox * mb;
+    sem_t syncSem;      ///< Posted when the E_SYNC EVENT is handled
+    Requests * requests; ///< Requests sent to other Examples and waiting for their reply
+    Coroutine co;       ///< Resume point of the ACTION in flight, if it yielded
+    ACTION coAction;    ///< ACTION in flight (A_NOP if none)
+    STATE coState;      ///< STATE entered once the ACTION in flight is over
+    int step;           ///< Step of the long ACTION example
+    char ioBuffer[IO_BUFFER_SIZE]; ///< Buffer of the asynchronous read in flight
+    int ioInFlight;     ///< 1 from the start of a read until its E_IO_DONE is handled
+    sem_t ioSem;        ///< Posted by the I/O callback once it does not use the Example anymore
+    int discard;        ///< Set by ExampleStopFleet() : the pending EVENTs are not handled anymore
+    CheckpointEntry * checkpoint; ///< Variables saved for a warm restart, NULL if not enabled
+    uint32_t layout;    ///< CHECKPOINT_LAYOUT, saved with the variables
+    int durable;        ///< 1 if the mailbox replays its messages after a restart
+    BudgetSlot * budget; ///< Duration of the ACTION running, looked at by the budget monitor
+    cpu_set_t cpus;     ///< CPUs allowed to run the Example, empty if not placed
+    int node;           ///< NUMA node of the Example, NUMA_NO_NODE if not placed
+    uint32_t crossNodeSends; ///< EVENTs sent from a CPU of another node
 
     // TODO : add here the instance variables you need to use.
     //Watchdog * wd; ///< Example of a watchdog implementation
@@ -148,6 +254,43 @@ static void ActionExample1FromRunning(Example * this);
 static void ActionExample2(Example * this);
 
 
+/**
+ * @brief Function called when another Example asks for a result
+ */
+static void ActionAnswer(Example * this);
+
+
+/**
+ * @brief Function called when the result of a request of this Example arrives
+ */
+static void ActionReply(Example * this);
+
+
+/**
+ * @brief Function called to start an asynchronous read
+ */
+static void ActionRead(Example * this);
+
+
+/**
+ * @brief Function called when an asynchronous read is over
+ */
+static void ActionIoDone(Example * this);
+
+/*------------- EVENT functions -------------*/
+
+/**
+ * @brief Sends an EVENT to the mailbox of the Example, counting the sends from another NUMA node
+ */
+static void ExampleSend(Example * this, char * msg);
+
+
+/**
+ * @brief Sends an EVENT from a shared thread (reply, timeout, I/O completion), without ever blocking it
+ */
+static void ExampleNotify(Example * this, char * msg);
+
+
 /*----------------------- STATE MACHINE DECLARATION -----------------------*/
 
 /**
@@ -163,6 +306,10 @@ static const ActionPtr actionPtr[NB_ACTION] = { // TODO : add all the function p
         &ActionExample1FromRunning,
         &ActionExample1FromIdle,
         &ActionExample2,
+        &ActionAnswer,
+        &ActionReply,
+        &ActionRead,
+        &ActionIoDone,
         &ActionKill
 };
 
@@ -173,16 +320,62 @@ static const ActionPtr actionPtr[NB_ACTION] = { // TODO : add all the function p
 static Transition stateMachine[NB_STATE][NB_EVENT] = { // TODO : fill the STATE machine
         [S_IDLE][E_EXAMPLE1]    = {S_RUNNING,	A_EXAMPLE1_FROM_IDLE},
         [S_RUNNING][E_EXAMPLE1] = {S_RUNNING, A_EXAMPLE1_FROM_RUNNING},
-        [S_RUNNING][E_EXAMPLE2] = {S_IDLE, A_EXAMPLE2}
+        [S_RUNNING][E_EXAMPLE2] = {S_IDLE, A_EXAMPLE2},
+        [S_IDLE][E_ASK]         = {S_IDLE, A_ANSWER},
+        [S_RUNNING][E_ASK]      = {S_RUNNING, A_ANSWER},
+        [S_IDLE][E_REPLY]       = {S_IDLE, A_REPLY},
+        [S_RUNNING][E_REPLY]    = {S_RUNNING, A_REPLY},
+        [S_IDLE][E_READ]        = {S_IDLE, A_READ},
+        [S_RUNNING][E_READ]     = {S_RUNNING, A_READ},
+        [S_IDLE][E_IO_DONE]     = {S_IDLE, A_IO_DONE},
+        [S_RUNNING][E_IO_DONE]  = {S_RUNNING, A_IO_DONE}
+};
+
+/**
+ * @brief EVENTs handled between two steps of an ACTION in flight, instead of waiting for its end
+ *
+ * Their ACTIONs must be short and must not yield, and they only run if their
+ * transition keeps the STATE. The other EVENTs are deferred until the ACTION
+ * in flight is over.
+ */
+static const int interleaved[NB_EVENT] = { // TODO : mark the EVENTs that do not depend on the ACTIONs in flight
+        [E_ASK]     = 1,
+        [E_REPLY]   = 1,
+        [E_IO_DONE] = 1
 };
 
+/**
+ * @brief Execution budget of the ACTIONs, by STATE in which they start, in microseconds
+ *
+ * An ACTION running longer blocks the mailbox of its Example : it is reported
+ * and counted in actionOverruns. A missing budget is DEFAULT_ACTION_BUDGET.
+ * The budget of an ACTION that yields applies to each of its steps.
+ */
+static const uint32_t actionBudget[NB_STATE][NB_ACTION] = { // TODO : give a budget to the ACTIONs
+        [S_IDLE][A_EXAMPLE1_FROM_IDLE]          = 1000, // Room for the TRACE of debug builds
+        [S_RUNNING][A_EXAMPLE1_FROM_RUNNING]    = 1000,
+        [S_RUNNING][A_EXAMPLE2]                 = 1000,
+        [S_IDLE][A_READ]                        = 2000, // Submits the read only
+        [S_RUNNING][A_READ]                     = 2000
+};
+
+/**
+ * @brief Number of ACTIONs that exceeded their budget, by STATE in which they started
+ */
+static uint32_t actionOverruns[NB_STATE][NB_ACTION];
+
 
 /* ----------------------- ACTIONS FUNCTIONS ----------------------- */
 
 // TODO : Write all the ACTION functions
 
 static void ActionExample1FromRunning(Example * this) {
-    TRACE("[ActionEx1FromRunning] - %d\n", this->msg.param)
+    CO_BEGIN(&this->co);
+    for (this->step = 0; this->step < LONG_ACTION_STEPS; this->step++) {
+        TRACE("[ActionEx1FromRunning] - %d step %d\n", this->msg.param, this->step)
+        CO_YIELD(&this->co); ///< Lets the run loop look at its mailbox
+    }
+    CO_END(&this->co);
 }
 
 
@@ -196,6 +389,63 @@ static void ActionExample2(Example * this) {
 }
 
 
+static void ActionAnswer(Example * this) {
+    TRACE("[ActionAnswer] - request %u : %d\n", this->msg.requestId, this->msg.param)
+    requestReply(this->msg.replyTo, this->msg.requestId, 2 * this->msg.param);
+}
+
+
+static void ActionReply(Example * this) {
+    TRACE("[ActionReply] - request %u : %s %d\n", this->msg.requestId,
+          REQUEST_STATUS_toString[this->msg.param2], this->msg.param)
+}
+
+
+/**
+ * @brief Sends the result of an asynchronous read to the mailbox of the Example
+ */
+static void ExampleIoCallback(void * caller, int64_t result, void * userData) {
+    (void) userData;
+    Example * this = caller;
+    Msg msg = {
+        .event = E_IO_DONE,
+        .param = (int) result
+    };
+
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    // Never blocks : the completion thread is shared by all the Examples
+    ExampleNotify(this, wrapper.toString);
+    sem_post(&this->ioSem);
+}
+
+
+static void ActionRead(Example * this) {
+    TRACE("[ActionRead] - fd %d\n", this->msg.param)
+    if (this->ioInFlight) { // The buffer is still being filled
+        TRACE("[ActionRead] - a read is already in flight : fd %d ignored\n", this->msg.param)
+        return;
+    }
+    this->ioInFlight = 1;
+    if (asyncIoRead(asyncIoDefault(), this->msg.param, this->ioBuffer, IO_BUFFER_SIZE - 1, 0,
+                    &ExampleIoCallback, this, NULL) != 0) {
+        ExampleIoCallback(this, -EIO, NULL); // The failure is handled like the end of the read
+    }
+}
+
+
+static void ActionIoDone(Example * this) {
+    TRACE("[ActionIoDone] - %d bytes\n", this->msg.param)
+    while (sem_wait(&this->ioSem) == -1 && errno == EINTR) { // Until the callback has returned
+    }
+    this->ioInFlight = 0;
+    if (this->msg.param >= 0) {
+        this->ioBuffer[this->msg.param] = '\0';
+    }
+}
+
+
 static void ActionNop(Example * this) {
     TRACE("[ActionNOP]\n")
 }
@@ -209,6 +459,20 @@ static void ActionKill(Example * this) {
 /*----------------------- EVENT FUNCTIONS -----------------------*/
 // TODO : write the events functions
 
+static void ExampleSend(Example * this, char * msg) {
+    if (this->node != NUMA_NO_NODE && numaGetCurrentNode() != this->node) {
+        __atomic_add_fetch(&this->crossNodeSends, 1, __ATOMIC_RELAXED);
+    }
+    mailboxSendMsg(this->mb, msg);
+}
+
+static void ExampleNotify(Example * this, char * msg) {
+    if (this->node != NUMA_NO_NODE && numaGetCurrentNode() != this->node) {
+        __atomic_add_fetch(&this->crossNodeSends, 1, __ATOMIC_RELAXED);
+    }
+    mailboxSendMsgUnbounded(this->mb, msg);
+}
+
 void ExampleEventOne(Example * this, int param) {
     Msg msg = {
         .event = E_EXAMPLE1,
@@ -218,7 +482,7 @@ void ExampleEventOne(Example * this, int param) {
     Wrapper wrapper;
     wrapper.data = msg;
 
-    mailboxSendMsg(this->mb, wrapper.toString);
+    ExampleSend(this, wrapper.toString);
 }
 
 void ExampleEventTwo(Example * this, int param) {
@@ -230,7 +494,77 @@ void ExampleEventTwo(Example * this, int param) {
     Wrapper wrapper;
     wrapper.data = msg;
 
-    mailboxSendMsg(this->mb, wrapper.toString);
+    ExampleSend(this, wrapper.toString);
+}
+
+void ExampleEventRead(Example * this, int fd) {
+    Msg msg = {
+        .event = E_READ,
+        .param = fd
+    };
+
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    ExampleSend(this, wrapper.toString);
+}
+
+int ExampleAsk(Example * this, Example * target, int param) {
+    Msg msg = {
+        .event = E_ASK,
+        .param = param,
+        .replyTo = this->requests,
+        .requestId = requestOpen(this->requests, REQUEST_TIMEOUT_DELAY)
+    };
+    if (msg.requestId == 0) { // The table is full : the reply could not be matched
+        return -1;
+    }
+
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    ExampleSend(target, wrapper.toString);
+    return 0;
+}
+
+/**
+ * @brief Sends the result of a request to the mailbox of the Example that asked for it
+ */
+static void ExampleReplyCallback(void * caller, RequestId id, REQUEST_STATUS status, intptr_t result) {
+    Example * this = caller;
+    Msg msg = {
+        .event = E_REPLY,
+        .param = (int) result,
+        .param2 = status,
+        .requestId = id
+    };
+
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    ExampleNotify(this, wrapper.toString);
+}
+
+void ExampleSync(Example * this) {
+    Msg msg = { .event = E_SYNC };
+
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    ExampleSend(this, wrapper.toString);
+    sem_wait(&this->syncSem);
+}
+
+long ExampleGetPending(Example * this) {
+    return mailboxGetCount(this->mb);
+}
+
+int ExampleGetCredits(Example * this) {
+    return mailboxGetCredits(this->mb);
+}
+
+uint32_t ExampleGetCrossNodeSends(Example * this) {
+    return __atomic_load_n(&this->crossNodeSends, __ATOMIC_RELAXED);
 }
 
 /*
@@ -247,6 +581,107 @@ extern void ExampleTimeout(Watchdog * wd, void * caller) {
 
 /* ----------------------- RUN FUNCTION ----------------------- */
 
+/**
+ * @brief Runs an ACTION, or one step of it, within its budget
+ */
+static void ExampleCall(Example * this, ACTION action, STATE state) {
+    STATE from = this->state;
+    uint32_t budget = (actionBudget[from][action] != 0) ? actionBudget[from][action] : DEFAULT_ACTION_BUDGET;
+
+    budgetBegin(this->budget, (uint64_t) budget * 1000, STATE_toString[from], ACTION_toString[action]);
+    uint64_t start = tracerNow();
+    actionPtr[action](this);
+    tracerSlice("action", ACTION_toString[action], start, "state", state);
+    if (budgetEnd(this->budget)) {
+        __atomic_add_fetch(&actionOverruns[from][action], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Runs an ACTION then enters its next STATE, unless the ACTION yielded
+ */
+static void ExampleStepAction(Example * this, ACTION action, STATE state) {
+    STATE from = this->state; // The ACTION may change the STATE itself
+    int resumed = (this->coAction != A_NOP);
+
+    ExampleCall(this, action, state);
+
+    if (CO_RUNNING(&this->co)) { // The ACTION yielded : the run loop will resume it
+        this->coAction = action;
+        this->coState = state;
+        return;
+    }
+    this->coAction = A_NOP;
+    if (resumed) { // Its message is handled at last : its credit and its ack were held back meanwhile
+        mailboxGrantCredits(this->mb, 1);
+        mailboxAck(this->mb);
+    }
+
+    // Entering a new STATE, or leaving a long ACTION : the deferred EVENTs are received again
+    if (state != from || resumed) {
+        this->state = state;
+        mailboxRecall(this->mb);
+    }
+}
+
+/**
+ * @brief Runs or resumes an ACTION, then enters the next STATE once the ACTION is over
+ */
+static void ExampleStep(Example * this, ACTION action, STATE state) {
+    if (this->checkpoint != NULL) { // The snapshots taken meanwhile are given up
+        checkpointBeginWrite(this->checkpoint);
+    }
+    ExampleStepAction(this, action, state);
+    if (this->checkpoint != NULL) {
+        checkpointEndWrite(this->checkpoint);
+    }
+}
+
+/**
+ * @brief Handles an EVENT received while an ACTION is in flight
+ *
+ * The interleaved EVENTs whose transition keeps the STATE are handled at
+ * once, the message of the ACTION in flight being put back after. The other
+ * EVENTs, E_SYNC included, are deferred until the ACTION is over : E_SYNC is
+ * then answered once the EVENTs received before it are handled.
+ *
+ * @note The caller checks that the EVENT can be deferred before receiving it
+ */
+static void ExampleInterleave(Example * this, Wrapper * wrapper) {
+    EVENT event = wrapper->data.event;
+    Transition transition = stateMachine[this->state][event];
+
+    if (event == E_SYNC || !interleaved[event]
+        || (transition.nextState != S_FORGET && transition.nextState != this->state)) {
+        mailboxDefer(this->mb, wrapper->toString);
+        return; // Its credit is given back once handled
+
+    } else if (transition.nextState != S_FORGET) {
+        Msg inFlight = this->msg;
+        if (this->checkpoint != NULL) {
+            checkpointBeginWrite(this->checkpoint);
+        }
+        this->msg = wrapper->data;
+        ExampleCall(this, transition.action, transition.nextState);
+        this->msg = inFlight;
+        if (this->checkpoint != NULL) {
+            checkpointEndWrite(this->checkpoint);
+        }
+    }
+    mailboxGrantCredits(this->mb, 1);
+}
+
+/**
+ * @brief Leaves the run loop. The last snapshot is taken before, in the current STATE.
+ */
+static void ExampleDie(Example * this) {
+    if (this->checkpoint != NULL) {
+        checkpointUnregister(this->checkpoint);
+        this->checkpoint = NULL;
+    }
+    this->state = S_DEATH;
+}
+
 /**
  * @brief Main running function of the Example class
  */
@@ -255,11 +690,33 @@ static void ExampleRun(Example * this) {
     STATE state;
     Wrapper wrapper;
 
+    tracerNameThread(this->nameTask);
+
     while (this->state != S_DEATH) {
+        if (__atomic_load_n(&this->discard, __ATOMIC_ACQUIRE)) { // Stopped without draining the mailbox
+            ExampleDie(this);
+            continue;
+        }
+        if (this->coAction != A_NOP) { // An ACTION is in flight : a waiting EVENT is looked at between two steps
+            // Once the deferred list is full, the EVENTs wait in the mailbox until the ACTION is over
+            // E_KILL is deferred too : the pending EVENTs are drained once the ACTION is over
+            if (mailboxCanDefer(this->mb) && mailboxTryReceive(this->mb, wrapper.toString) == 0) {
+                ExampleInterleave(this, &wrapper);
+            }
+            ExampleStep(this, this->coAction, this->coState);
+            continue;
+        }
+
         mailboxReceive(this->mb, wrapper.toString); ///< Receiving an EVENT from the mailbox
 
         if (wrapper.data.event == E_KILL) { // If we received the stop EVENT, we do nothing and we change the STATE to death.
-            this->state = S_DEATH;
+            ExampleDie(this);
+
+        } else if (wrapper.data.event == E_SYNC) { // Every EVENT sent before the sync has been handled
+            mailboxGrantCredits(this->mb, 1); // Before the answer : the caller finds every credit back
+            mailboxAck(this->mb);
+            sem_post(&this->syncSem);
+            continue;
 
         } else {
             action = stateMachine[this->state][wrapper.data.event].action;
@@ -269,30 +726,108 @@ static void ExampleRun(Example * this) {
             state = stateMachine[this->state][wrapper.data.event].nextState;
             TRACE("State %s\n", STATE_toString[state])
 
-            if (state != S_FORGET) {
+            if (state == S_DEFER) { // Kept outside of the mailbox queue, its credit is given back once handled
+                if (mailboxDefer(this->mb, wrapper.toString) == 0) {
+                    continue;
+                }
+                TRACE("Too many deferred EVENTs : %s forgotten\n", EVENT_toString[wrapper.data.event])
+
+            } else if (state != S_FORGET) {
                 this->msg = wrapper.data;
-                actionPtr[action](this);
-                this->state = state;
+                ExampleStep(this, action, state);
             }
         }
+        if (this->coAction == A_NOP) { // Else the ACTION in flight gives them once it is over
+            mailboxGrantCredits(this->mb, 1); ///< The message is handled, its sender can send another one
+            mailboxAck(this->mb);             ///< It is not replayed after a restart (durable mailbox only)
+        }
     }
 }
 
 /* ----------------------- NEW START STOP FREE -----------------------*/
 
+/**
+ * @brief Adds a slot to the budget monitor shared by all the Examples, created by the first one
+ */
+static BudgetSlot * ExampleMonitorJoin(const char * name) {
+    pthread_mutex_lock(&exampleMonitorMutex);
+    if (exampleMonitorUsers++ == 0) {
+        exampleMonitor = budgetMonitorNew(BUDGET_MONITOR_PERIOD, NULL);
+    }
+    BudgetSlot * slot = budgetSlotNew(exampleMonitor, name);
+    pthread_mutex_unlock(&exampleMonitorMutex);
+    return slot;
+}
+
+/**
+ * @brief Removes a slot from the budget monitor, which is stopped with the last Example
+ */
+static void ExampleMonitorLeave(BudgetSlot * slot) {
+    pthread_mutex_lock(&exampleMonitorMutex);
+    budgetSlotFree(slot);
+    if (--exampleMonitorUsers == 0) {
+        budgetMonitorFree(exampleMonitor);
+        exampleMonitor = NULL;
+    }
+    pthread_mutex_unlock(&exampleMonitorMutex);
+}
+
 Example * ExampleNew() {
+    return ExampleNewDurable(NULL);
+}
+
+
+Example * ExampleNewDurable(Journal * journal) {
+    return ExampleNewPlaced(journal, NULL, 0);
+}
+
+
+Example * ExampleNewPlaced(Journal * journal, const void * cpus, size_t size) {
     // TODO : initialize the object with it particularities
-    exampleCounter ++; ///< Incrementing the instances counter.
     TRACE("ExampleNew function \n")
-    Example * this = (Example *) malloc(sizeof(Example));
-    this->mb = mailboxInit("Example", exampleCounter, sizeof(Msg));
+    cpu_set_t placed; // The CPUs beyond CPU_SETSIZE are ignored
+    CPU_ZERO(&placed);
+    if (cpus != NULL) {
+        memcpy(&placed, cpus, min(size, sizeof(placed)));
+    }
+    int node = (CPU_COUNT(&placed) > 0) ? numaGetNodeOfCpuSet(&placed) : NUMA_NO_NODE;
+    Example * this = (Example *) numaAlloc(sizeof(Example), node);
+    this->cpus = placed;
+    this->node = node;
+    this->crossNodeSends = 0;
+    // The mailboxes of the pool are not placed
+    MailboxPool * pool = __atomic_load_n(&examplePool, __ATOMIC_ACQUIRE);
+    this->mb = (journal == NULL && node == NUMA_NO_NODE && pool != NULL) ? mailboxPoolTake(pool) : NULL;
+    int counter;
+    if (this->mb != NULL) { // Its instance number was reserved by ExampleWarmUp()
+        counter = mailboxGetCounter(this->mb);
+    } else {
+        // Incrementing the instances counter. Atomic, so that the Examples can be constructed in parallel.
+        counter = __atomic_add_fetch(&exampleCounter, 1, __ATOMIC_RELAXED);
+        this->mb = mailboxInitPlaced("Example", counter, sizeof(Msg), journal, node);
+    }
     this->state = S_IDLE;
+    sem_init(&this->syncSem, 0, 0);
+    CO_INIT(&this->co);
+    this->coAction = A_NOP;
+    this->step = 0;
+    this->ioInFlight = 0;
+    sem_init(&this->ioSem, 0, 0);
+    this->discard = 0;
+    this->requests = requestsNew(MAX_PENDING_REQUESTS, &ExampleReplyCallback, this);
 
     //this->wd = WatchdogConstruct(1000, &ExampleTimeout, this); ///< Declaration of a watchdog.
 
-    int err = sprintf(this->nameTask, NAME_TASK, exampleCounter);
+    int err = snprintf(this->nameTask, SIZE_TASK_NAME, NAME_TASK, counter);
     STOP_ON_ERROR(err < 0, "Error when setting the tasks name.")
 
+    this->budget = ExampleMonitorJoin(this->nameTask);
+
+    this->checkpoint = NULL; // Saved once it has a key : ExampleSetCheckpointKey()
+    this->layout = CHECKPOINT_LAYOUT;
+    this->durable = (journal != NULL);
+    mailboxEnableCredits(this->mb, MQ_MAX_MESSAGES);
+
     return this; // TODO: Handle the errors
 }
 
@@ -300,7 +835,13 @@ Example * ExampleNew() {
 int ExampleStart(Example * this) {
     // TODO : start the object with it particularities
     TRACE("ExampleStart function \n")
-    int err = pthread_create(&(this->threadId), NULL, (void *) ExampleRun, this);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (CPU_COUNT(&this->cpus) > 0) { // Runs next to its memory
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &this->cpus);
+    }
+    int err = pthread_create(&(this->threadId), &attr, (void *) ExampleRun, this);
+    pthread_attr_destroy(&attr);
     STOP_ON_ERROR(err != 0, "Error when creating the thread")
 
     return 0; // TODO: Handle the errors
@@ -327,10 +868,239 @@ int ExampleStop(Example * this) {
 int ExampleFree(Example * this) {
     // TODO : free the object with it particularities
     TRACE("ExampleFree function \n")
+    if (this->ioInFlight) { // Its E_IO_DONE was not handled : the callback may still use the Example
+        asyncIoCancel(asyncIoDefault(), this); // An idle pipe or socket would never call it
+        while (sem_wait(&this->ioSem) == -1 && errno == EINTR) {
+        }
+    }
+    if (this->checkpoint != NULL) { // Never started
+        checkpointUnregister(this->checkpoint);
+    }
+    ExampleMonitorLeave(this->budget);
+    requestsFree(this->requests);
     mailboxClose(this->mb);
+    sem_destroy(&this->syncSem);
+    sem_destroy(&this->ioSem);
 
-    free(this);
+    numaFree(this);
 
     return 0; // TODO: Handle the errors
 }
 
+
+/* ----------------------- FLEET -----------------------*/
+
+/**
+ * @brief Part of a fleet constructed by one thread
+ */
+typedef struct {
+    Example ** fleet;
+    int count;
+} FleetSlice;
+
+static void * ExampleNewSlice(void * arg) {
+    FleetSlice * slice = arg;
+    for (int i = 0; i < slice->count; i++) {
+        slice->fleet[i] = ExampleNew();
+    }
+    return NULL;
+}
+
+
+uint32_t ExampleGetOverruns(Example * this) {
+    return (uint32_t) budgetGetOverruns(this->budget, NULL, NULL);
+}
+
+
+void ExampleReportOverruns(FILE * out) {
+    for (int state = 0; state < NB_STATE; state++) {
+        for (int action = 0; action < NB_ACTION; action++) {
+            uint32_t overruns = __atomic_load_n(&actionOverruns[state][action], __ATOMIC_RELAXED);
+            if (overruns > 0) {
+                fprintf(out, "%s / %s : %u overruns of %u us\n", STATE_toString[state], ACTION_toString[action],
+                        overruns, (actionBudget[state][action] != 0) ? actionBudget[state][action] : DEFAULT_ACTION_BUDGET);
+            }
+        }
+    }
+}
+
+
+int ExampleEnableCheckpoint(const char * path, uint32_t capacity, uint32_t period) {
+    exampleCheckpoint = checkpointOpen(path, capacity, CHECKPOINT_SLOT_SIZE);
+    if (exampleCheckpoint == NULL) {
+        return -1;
+    }
+    return checkpointStart(exampleCheckpoint, period);
+}
+
+
+int ExampleSetCheckpointKey(Example * this, const char * key) {
+    int wrong = (key == NULL || strlen(key) >= CHECKPOINT_NAME_LENGTH || this->checkpoint != NULL);
+    ERROR(wrong, "Wrong checkpoint key, or the Example already has one\n")
+    if (wrong || exampleCheckpoint == NULL) {
+        return -1;
+    }
+    this->checkpoint = checkpointRegister(exampleCheckpoint, key);
+    if (this->checkpoint == NULL) {
+        return -1;
+    }
+    checkpointAddField(this->checkpoint, &this->layout, sizeof(this->layout));
+    checkpointAddField(this->checkpoint, &this->state, sizeof(this->state));
+    // The ACTION in flight and its message : the ACTION is run again from its beginning
+    checkpointAddField(this->checkpoint, &this->coAction, sizeof(this->coAction));
+    checkpointAddField(this->checkpoint, &this->coState, sizeof(this->coState));
+    checkpointAddField(this->checkpoint, &this->msg, sizeof(this->msg));
+    // TODO : add here the instance variables to restore
+
+    if (checkpointRestore(this->checkpoint) == 0) {
+        if (this->layout != CHECKPOINT_LAYOUT || this->state < S_IDLE || this->state >= S_DEATH) {
+            this->state = S_IDLE; // Saved by another build, or while stopping : it starts again from the beginning
+            this->coAction = A_NOP;
+        }
+        // A durable mailbox replays the message of the ACTION itself
+        if (this->durable || this->coAction <= A_NOP || this->coAction >= NB_ACTION
+            || this->coState < S_IDLE || this->coState >= S_DEATH) {
+            this->coAction = A_NOP;
+        }
+        this->layout = CHECKPOINT_LAYOUT;
+        this->msg.replyTo = NULL; // The Requests of the previous run do not exist anymore
+    }
+    CO_INIT(&this->co);
+    this->step = 0;
+    // The message of a restarted ACTION was received by the previous run : it gives back a credit it never took
+    mailboxEnableCredits(this->mb, MQ_MAX_MESSAGES - (this->coAction != A_NOP));
+
+    return 0;
+}
+
+
+void ExampleDisableCheckpoint() {
+    if (exampleCheckpoint != NULL) {
+        checkpointClose(exampleCheckpoint);
+        exampleCheckpoint = NULL;
+    }
+}
+
+
+void ExampleWarmUp(int count) {
+    MailboxPool * pool = __atomic_load_n(&examplePool, __ATOMIC_ACQUIRE);
+    if (pool == NULL) { // Read by ExampleNew(), which can run at the same time
+        MailboxPool * created = mailboxPoolNew("Example", sizeof(Msg));
+        if (__atomic_compare_exchange_n(&examplePool, &pool, created, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            pool = created;
+        } else { // Created by another thread meanwhile
+            mailboxPoolFree(created);
+        }
+    }
+    // The instance numbers of the pool are reserved, so they are never used by ExampleNew()
+    int first = __atomic_fetch_add(&exampleCounter, count, __ATOMIC_RELAXED) + 1;
+    mailboxPoolFill(pool, first, count);
+}
+
+
+void ExampleCoolDown() {
+    MailboxPool * pool = __atomic_exchange_n(&examplePool, NULL, __ATOMIC_ACQ_REL);
+    if (pool != NULL) {
+        mailboxPoolFree(pool);
+    }
+}
+
+
+Example ** ExampleNewFleet(int count) {
+    Example ** fleet = (Example **) malloc(count * sizeof(Example *));
+    STOP_ON_ERROR(fleet == NULL, "Error during memory allocation of the fleet : ")
+
+    long nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nbThreads > count / FLEET_MIN_PER_THREAD) {
+        nbThreads = count / FLEET_MIN_PER_THREAD;
+    }
+    if (nbThreads < 1) {
+        nbThreads = 1;
+    }
+
+    FleetSlice * slices = (FleetSlice *) malloc(nbThreads * sizeof(FleetSlice));
+    pthread_t * threads = (pthread_t *) malloc(nbThreads * sizeof(pthread_t));
+    int * started = (int *) malloc(nbThreads * sizeof(int));
+    STOP_ON_ERROR(slices == NULL || threads == NULL || started == NULL,
+                  "Error during memory allocation of the fleet threads : ")
+    int done = 0;
+    for (long t = 0; t < nbThreads; t++) {
+        int size = (count - done) / (int) (nbThreads - t);
+        slices[t].fleet = fleet + done;
+        slices[t].count = size;
+        done += size;
+        // The first slice is constructed by the calling thread
+        started[t] = (t > 0 && pthread_create(&threads[t], NULL, &ExampleNewSlice, &slices[t]) == 0);
+        if (t > 0 && !started[t]) {
+            ExampleNewSlice(&slices[t]);
+        }
+    }
+    ExampleNewSlice(&slices[0]);
+    for (long t = 1; t < nbThreads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    free(slices);
+    free(threads);
+    free(started);
+
+    TRACE("%d Examples constructed with %ld threads\n", count, nbThreads)
+    return fleet;
+}
+
+
+void ExampleFreeFleet(Example ** fleet, int count) {
+    for (int i = 0; i < count; i++) {
+        ExampleFree(fleet[i]);
+    }
+    free(fleet);
+}
+
+
+int ExampleStopFleet(Example ** fleet, int count, ExampleStopMode mode, uint32_t timeout, Example ** late) {
+    int wrong = (count <= 0);
+    ERROR(wrong, "Wrong number of Examples to stop\n")
+    if (wrong) {
+        return -1;
+    }
+
+    Msg msg = { .event = E_KILL };
+    Wrapper wrapper;
+    wrapper.data = msg;
+
+    // One deadline for the whole fleet, in CLOCK_REALTIME as mq_timedsend and pthread_timedjoin_np expect
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    // The stop EVENT is sent to every Example before any of them is waited for,
+    // so they all drain their mailbox at the same time
+    int * sent = (int *) malloc(count * sizeof(int));
+    STOP_ON_ERROR(sent == NULL, "Error during memory allocation of the fleet stop : ")
+    for (int i = 0; i < count; i++) {
+        if (mode == EXAMPLE_STOP_DISCARD) {
+            __atomic_store_n(&fleet[i]->discard, 1, __ATOMIC_RELEASE);
+        }
+        sent[i] = (mailboxTimedSendStop(fleet[i]->mb, wrapper.toString,
+                                        mode == EXAMPLE_STOP_DISCARD, &deadline) == 0);
+    }
+
+    int nbLate = 0;
+    for (int i = 0; i < count; i++) {
+        if (!sent[i] || pthread_timedjoin_np(fleet[i]->threadId, NULL, &deadline) != 0) {
+            TRACE("%s missed the stop deadline\n", fleet[i]->nameTask)
+            if (late != NULL) {
+                late[nbLate] = fleet[i];
+            }
+            nbLate++;
+        }
+    }
+    free(sent);
+    return nbLate;
+}
@@ -28,10 +28,22 @@
 #ifndef EXAMPLE_H
 #define EXAMPLE_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <journal.h>
 #include <watchdog.h>
 
 typedef struct Example_t Example;
 
+/**
+ * @brief What the Examples do with their pending EVENTs when they are stopped
+ */
+typedef enum {
+    EXAMPLE_STOP_DRAIN,     ///< The EVENTs sent before the stop are handled
+    EXAMPLE_STOP_DISCARD    ///< The EVENTs not handled yet are dropped
+} ExampleStopMode;
+
 /* ----------------------- PUBLIC FUNCTIONS PROTOTYPES -----------------------*/
 
 /**
@@ -48,6 +60,59 @@ extern void ExampleEventOne(Example * this, int param);
  */
 extern void ExampleEventTwo(Example * this, int param);
 
+/**
+ * @brief Function that raises the E_READ event
+ *
+ * The Example reads the beginning of the file without blocking its thread :
+ * the end of the read arrives later as an E_IO_DONE event. The EVENT is
+ * ignored while a read is already in flight.
+ *
+ * @param[in] fd file descriptor to read
+ */
+extern void ExampleEventRead(Example * this, int fd);
+
+/**
+ * @brief Asks another Example for a result, without waiting for it
+ *
+ * The result arrives later as an E_REPLY event in the mailbox of this Example,
+ * or as a timeout if the target did not answer in time.
+ *
+ * @param[in] target Example that computes the result
+ * @param[in] param paramter of the request
+ * @retval 0 If the request has been sent
+ * @retval -1 If too many requests of this Example are pending : nothing is sent
+ */
+extern int ExampleAsk(Example * this, Example * target, int param);
+
+/**
+ * @brief Waits until every event sent before the call has been handled
+ *
+ * @note Must not be called from the Example thread itself
+ */
+extern void ExampleSync(Example * this);
+
+/**
+ * @brief Returns the number of events waiting in the Example mailbox
+ */
+extern long ExampleGetPending(Example * this);
+
+/**
+ * @brief Returns the number of events that can be sent to the Example without blocking
+ *
+ * A producer can check it to slow down, batch or divert its events before the
+ * mailbox of the Example is full. A credit is given back each time the Example
+ * has handled an event.
+ */
+extern int ExampleGetCredits(Example * this);
+
+/**
+ * @brief Returns the number of EVENTs sent to the Example from a CPU of
+ * another NUMA node than its own
+ *
+ * @note Always 0 if the Example is not placed with ExampleNewPlaced()
+ */
+extern uint32_t ExampleGetCrossNodeSends(Example * this);
+
 /**
  * @brief Example function that treats a wathdog event.
  */
@@ -66,6 +131,31 @@ extern void ExampleTimeout(Watchdog * wd, void * caller);
  */
 extern Example * ExampleNew();
 
+/**
+ * @brief Example class constructor, with a durable mailbox
+ *
+ * The EVENTs sent to the Example are kept in the journal until they are
+ * handled. The EVENTs left in the journal by a previous run are handled
+ * first, as soon as the Example is started.
+ *
+ * @param[in] journal journal of the Example, opened with journalOpen() and
+ * closed after ExampleFree(). NULL for a usual mailbox.
+ */
+extern Example * ExampleNewDurable(Journal * journal);
+
+/**
+ * @brief Example class constructor, placed on the NUMA node of the CPUs that run it
+ *
+ * The Example and its mailbox are allocated on the node with the most CPUs
+ * of the set, and the thread of the Example only runs on these CPUs.
+ *
+ * @param[in] journal journal of the Example, NULL for a usual mailbox
+ * @param[in] cpus CPUs allowed to run the Example, a cpu_set_t as given to
+ * sched_setaffinity(), NULL to not place it
+ * @param[in] size size of the set pointed by cpus, in bytes
+ */
+extern Example * ExampleNewPlaced(Journal * journal, const void * cpus, size_t size);
+
 
 /**
  * @brief Example class starter
@@ -90,10 +180,116 @@ extern int ExampleStop ();
 /**
  * @brief Example singleton destructor
  *
+ * @note Waits for the end of the read in flight, if any
  * @retval 0 If the destruction worked
  * @retval -1 if the destruction didn't work
  */
 
 extern int ExampleFree ();
 
+/* ----------------------- ACTION BUDGETS -----------------------*/
+
+/**
+ * @brief Returns the number of ACTIONs of the Example that exceeded their budget
+ */
+extern uint32_t ExampleGetOverruns(Example * this);
+
+/**
+ * @brief Prints the number of overruns of each transition of the Example class
+ *
+ * @param[in] out stream where the transitions with overruns are printed
+ */
+extern void ExampleReportOverruns(FILE * out);
+
+/* ----------------------- CHECKPOINT -----------------------*/
+
+/**
+ * @brief Saves the STATE of the Examples periodically, for a warm restart
+ *
+ * Only the Examples given a key by ExampleSetCheckpointKey() are saved.
+ *
+ * @param[in] path checkpoint file
+ * @param[in] capacity maximum number of Examples saved in the file
+ * @param[in] period delay between two snapshots, in milliseconds
+ * @retval 0 If the snapshots are started
+ * @retval -1 If the file could not be opened
+ */
+extern int ExampleEnableCheckpoint(const char * path, uint32_t capacity, uint32_t period);
+
+/**
+ * @brief Saves an Example under a key, and restores it from its last snapshot if the file has one
+ *
+ * The Example starts again from the STATE of the snapshot. An ACTION that was
+ * in flight is run again from its beginning, with its message. The message
+ * of a durable Example is replayed by its journal instead. A snapshot taken
+ * by a build with other STATEs, ACTIONs or variables is ignored.
+ *
+ * @note Called between the construction and ExampleStart()
+ * @param[in] key name of the Example in the checkpoint file, the same from
+ * one run to the other, shorter than CHECKPOINT_NAME_LENGTH
+ * @retval 0 If the Example is saved
+ * @retval -1 If the checkpoints are not enabled, the key is wrong, or the file is full
+ */
+extern int ExampleSetCheckpointKey(Example * this, const char * key);
+
+/**
+ * @brief Takes a last snapshot and closes the checkpoint file
+ *
+ * @note The Examples must be freed before
+ */
+extern void ExampleDisableCheckpoint();
+
+/* ----------------------- FLEET -----------------------*/
+
+/**
+ * @brief Creates the mailboxes of the next Examples in advance
+ *
+ * The Examples constructed later take their mailbox from this pool instead
+ * of creating it, which makes ExampleNew() much faster. The mailboxes are
+ * created in parallel.
+ *
+ * @param[in] count number of mailboxes to create
+ */
+extern void ExampleWarmUp(int count);
+
+/**
+ * @brief Destroys the mailboxes created by ExampleWarmUp() and not used
+ *
+ * @note Must not be called while Examples are constructed
+ */
+extern void ExampleCoolDown();
+
+/**
+ * @brief Constructs several Examples in parallel
+ *
+ * @param[in] count number of Examples
+ * @return an array of count Examples, freed by ExampleFreeFleet()
+ */
+extern Example ** ExampleNewFleet(int count);
+
+/**
+ * @brief Stops the Examples of a fleet at the same time, within a deadline
+ *
+ * The stop EVENT is sent to every Example first, then all of them are
+ * waited for until the same deadline : stopping the fleet takes about the
+ * time of the slowest Example, not the sum of their times.
+ *
+ * The Examples that missed the deadline are still running. They can be
+ * stopped again later, and must not be freed before.
+ *
+ * @param[in] mode EXAMPLE_STOP_DRAIN or EXAMPLE_STOP_DISCARD
+ * @param[in] timeout delay given to the whole fleet, in milliseconds
+ * @param[out] late array of count Examples, filled with the ones that missed
+ * the deadline, or NULL
+ * @return the number of Examples that missed the deadline, -1 if count is not positive
+ */
+extern int ExampleStopFleet(Example ** fleet, int count, ExampleStopMode mode, uint32_t timeout, Example ** late);
+
+/**
+ * @brief Destroys the Examples of a fleet, and the fleet array
+ *
+ * @note The Examples must be stopped
+ */
+extern void ExampleFreeFleet(Example ** fleet, int count);
+
 #endif //EXAMPLE_H
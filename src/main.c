@@ -13,11 +13,27 @@
  */
 
 
+#include <tracer.h>
+
 #include "example/example.h"
 #include "stdio.h"
+#include "stdlib.h"
+#include "signal.h"
+
+/**
+ * @def Size of the trace buffer, in events
+ */
+#define TRACE_CAPACITY (65536)
 
 int main() {
 
+     // Set EXAMPLE_TRACE to the path of a Chrome trace file to record the timeline of the run
+     char * tracePath = getenv("EXAMPLE_TRACE");
+     if (tracePath != NULL) {
+         tracerEnable(TRACE_CAPACITY);
+         tracerDumpOnSignal(SIGUSR1, tracePath);
+     }
+
      Example * test = ExampleNew();
      ExampleStart(test);
 
@@ -27,4 +43,8 @@ int main() {
      ExampleStop(test);
      ExampleFree(test);
 
+     if (tracePath != NULL) {
+         tracerDump(tracePath);
+     }
+
 }
@@ -0,0 +1,99 @@
+/**
+ * @file edfTest.c
+ *
+ * @brief Test of the earliest deadline first scheduler, with one worker
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <errno.h>
+#include <semaphore.h>
+#include <edf.h>
+
+#include "test.h"
+
+
+#define NB_MESSAGES 4
+
+static sem_t blocker;       ///< Holds the worker in the first message, while the next ones are posted
+static sem_t handled;       ///< Posted after each message
+static int order[NB_MESSAGES];
+static int nbHandled = 0;
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void waitFor(sem_t * sem) {
+    while (sem_wait(sem) == -1 && errno == EINTR) {
+    }
+}
+
+static void handleBlocking(void * caller, void * msg, uint64_t deadline) {
+    (void) caller;
+    (void) msg;
+    (void) deadline;
+    waitFor(&blocker);
+    sem_post(&handled);
+}
+
+static void handleOrdered(void * caller, void * msg, uint64_t deadline) {
+    (void) caller;
+    (void) deadline;
+    order[nbHandled++] = *(int *) msg; // Only one worker : no concurrent call
+    sem_post(&handled);
+}
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    sem_init(&blocker, 0, 0);
+    sem_init(&handled, 0, 0);
+
+    EdfScheduler * scheduler = edfNew(1);
+    CHECK(scheduler != NULL)
+    EdfTask * busy = edfAddTask(scheduler, &handleBlocking, NULL, "busy");
+    EdfTask * task = edfAddTask(scheduler, &handleOrdered, NULL, "ordered");
+
+    int msg = 0;
+    edfPost(busy, &msg, sizeof(msg), EDF_NO_DEADLINE);
+
+    // Posted while the worker is busy : handled by deadline, then without deadline
+    msg = 3;
+    edfPost(task, &msg, sizeof(msg), EDF_NO_DEADLINE);
+    msg = 2;
+    edfPost(task, &msg, sizeof(msg), edfDeadlineIn(2000));
+    msg = 1;
+    edfPost(task, &msg, sizeof(msg), edfDeadlineIn(1000));
+    msg = 0;
+    edfPost(task, &msg, sizeof(msg), edfNow()); // Already missed once handled
+
+    EdfStats stats;
+    edfGetStats(task, &stats);
+    CHECK(stats.pending == NB_MESSAGES)
+
+    sem_post(&blocker);
+    for (int i = 0; i < NB_MESSAGES + 1; i++) {
+        waitFor(&handled);
+    }
+    for (int i = 0; i < NB_MESSAGES; i++) {
+        CHECK(order[i] == i)
+    }
+
+    do { // The statistics are updated once the handler has returned
+        edfGetStats(task, &stats);
+    } while (stats.handled < NB_MESSAGES);
+    CHECK(stats.missed == 1)
+    CHECK(stats.pending == 0)
+
+    edfRemoveTask(busy);
+    edfRemoveTask(task);
+    edfFree(scheduler);
+    sem_destroy(&blocker);
+    sem_destroy(&handled);
+
+    return EXIT_SUCCESS;
+}
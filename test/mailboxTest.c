@@ -0,0 +1,88 @@
+/**
+ * @file mailboxTest.c
+ *
+ * @brief Test of the durable mailbox : restart of an Example with EVENTs left in its journal
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <dirent.h>
+#include <unistd.h>
+#include <journal.h>
+#include <mailbox.h>
+
+#include "example/example.h"
+#include "test.h"
+
+
+#define NB_PENDING 4       ///< EVENTs sent before the first run stops, fewer than MQ_MAX_MESSAGES
+
+static char directory[] = "/tmp/mailboxTestXXXXXX";
+static char path[sizeof(directory) + 16];
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void removeJournal(void) {
+    DIR * dir = opendir(directory);
+    CHECK(dir != NULL)
+    char file[sizeof(directory) + 256 + 1];
+    for (struct dirent * entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            snprintf(file, sizeof(file), "%s/%s", directory, entry->d_name);
+            unlink(file);
+        }
+    }
+    closedir(dir);
+    rmdir(directory);
+}
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    CHECK(mkdtemp(directory) != NULL)
+    snprintf(path, sizeof(path), "%s/example", directory);
+
+    // First run : the EVENTs are journaled, and the Example is freed before handling them
+    Journal * journal = journalOpen(path, JOURNAL_SEGMENT_SIZE, 1, 0);
+    CHECK(journal != NULL)
+    Example * example = ExampleNewDurable(journal);
+    for (int i = 0; i < NB_PENDING; i++) {
+        ExampleEventOne(example, i);
+    }
+    CHECK(ExampleGetCredits(example) == MQ_MAX_MESSAGES - NB_PENDING)
+    ExampleFree(example);
+    journalClose(journal);
+
+    // Restart : the replayed EVENTs hold their credits until they are handled
+    journal = journalOpen(path, JOURNAL_SEGMENT_SIZE, 1, 0);
+    CHECK(journal != NULL)
+    example = ExampleNewDurable(journal);
+    CHECK(ExampleGetPending(example) == NB_PENDING)
+    CHECK(ExampleGetCredits(example) == MQ_MAX_MESSAGES - NB_PENDING)
+
+    ExampleStart(example);
+    ExampleSync(example);
+    CHECK(ExampleGetPending(example) == 0)
+    CHECK(ExampleGetCredits(example) == MQ_MAX_MESSAGES)
+
+    ExampleStop(example);
+    ExampleFree(example);
+    journalClose(journal);
+
+    // Nothing left to replay
+    journal = journalOpen(path, JOURNAL_SEGMENT_SIZE, 1, 0);
+    CHECK(journal != NULL)
+    example = ExampleNewDurable(journal);
+    CHECK(ExampleGetPending(example) == 0)
+    CHECK(ExampleGetCredits(example) == MQ_MAX_MESSAGES)
+    ExampleFree(example);
+    journalClose(journal);
+
+    removeJournal();
+    return EXIT_SUCCESS;
+}
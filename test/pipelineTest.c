@@ -0,0 +1,83 @@
+/**
+ * @file pipelineTest.c
+ *
+ * @brief Test of the pipeline library, with a filter fused to the first stage
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <pipeline.h>
+
+#include "test.h"
+
+
+#define NB_BUFFERS 2
+#define NB_PUSHED 1000
+#define FILTER 5
+
+static int64_t received = 0;   ///< Only used by the thread of the last stage
+static int64_t sum = 0;
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static int stageIncrement(void * caller, void * buffer) {
+    (void) caller;
+    (*(int64_t *) buffer)++;
+    return PIPELINE_FORWARD;
+}
+
+static int stageFilter(void * caller, void * buffer) {
+    (void) caller;
+    return (*(int64_t *) buffer % FILTER == 0) ? PIPELINE_RELEASE : PIPELINE_FORWARD;
+}
+
+static int stageCollect(void * caller, void * buffer) {
+    (void) caller;
+    received++;
+    sum += *(int64_t *) buffer;
+    return PIPELINE_FORWARD; // The last stage : the buffer goes back to the pool
+}
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    // Fewer buffers than messages : each buffer goes through the pipeline several times
+    Pipeline * pipeline = pipelineNew(sizeof(int64_t), NB_BUFFERS);
+    CHECK(pipeline != NULL)
+    pipelineAddStage(pipeline, &stageIncrement, NULL, "increment", 0);
+    pipelineAddStage(pipeline, &stageFilter, NULL, "filter", 1);
+    pipelineAddStage(pipeline, &stageCollect, NULL, "collect", 0);
+    pipelineStart(pipeline);
+
+    int64_t expected = 0;
+    int64_t kept = 0;
+    for (int64_t i = 0; i < NB_PUSHED; i++) {
+        int64_t * buffer = pipelineAcquire(pipeline);
+        *buffer = i;
+        pipelinePush(pipeline, buffer);
+        if ((i + 1) % FILTER != 0) {
+            expected += i + 1;
+            kept++;
+        }
+    }
+    pipelineStop(pipeline); // The pushed buffers have gone through all the stages
+
+    CHECK(received == kept)
+    CHECK(sum == expected)
+
+    // Every buffer is back in the pool
+    void * buffers[NB_BUFFERS];
+    for (int i = 0; i < NB_BUFFERS; i++) {
+        buffers[i] = pipelineAcquire(pipeline);
+        CHECK(buffers[i] != NULL)
+    }
+    CHECK(buffers[0] != buffers[1])
+    pipelineFree(pipeline);
+
+    return EXIT_SUCCESS;
+}
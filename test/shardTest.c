@@ -0,0 +1,198 @@
+/**
+ * @file shardTest.c
+ *
+ * @brief Test of the shard library, with replicas that check the order of the events of each key
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <shard.h>
+#include <typedmailbox.h>
+
+#include "test.h"
+
+
+#define NB_KEYS 64
+#define NB_SEQ 32               ///< Events sent to each key before the grow, then after it
+#define HANDLING_DELAY 20       ///< Microseconds spent on each event : the replicas are behind when the shard grows
+#define MIN_REPLICAS 2
+#define MAX_REPLICAS 3
+
+typedef enum { M_EVENT, M_SYNC, M_STOP } MSG_KIND;
+
+typedef struct {
+    MSG_KIND kind;
+    uint64_t key;
+    int seq;
+    sem_t * done;       ///< Posted once handled (M_SYNC)
+} Msg;
+
+MAILBOX_DECL(Replica, Msg, 256)
+
+/**
+ * @brief Replica of the test : a thread that handles the events of its mailbox
+ */
+typedef struct {
+    int id;                     ///< Order of creation
+    ReplicaMailbox mb;
+    pthread_t thread;
+} Replica;
+
+static int nbReplicas = 0;      ///< Only changed by the rebalance, one at a time
+static int lastSeq[NB_KEYS];    ///< Last event handled for each key, by any replica
+static int handledBy[NB_KEYS];  ///< Replica that handled the last event of each key
+static int disorders = 0;       ///< Events handled out of the order of their key
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void * replicaRun(void * arg) {
+    Replica * this = arg;
+    Msg msg;
+
+    for (;;) {
+        ReplicaMailboxReceive(&this->mb, &msg);
+        if (msg.kind == M_STOP) {
+            break;
+        } else if (msg.kind == M_SYNC) {
+            sem_post(msg.done);
+        } else {
+            usleep(HANDLING_DELAY);
+            // The events of a key are handled by one replica at a time, in the order they were sent
+            int last = __atomic_load_n(&lastSeq[msg.key], __ATOMIC_ACQUIRE);
+            if (msg.seq != last + 1) {
+                __atomic_add_fetch(&disorders, 1, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&handledBy[msg.key], this->id, __ATOMIC_RELAXED);
+            __atomic_store_n(&lastSeq[msg.key], msg.seq, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static void * replicaNew(void) {
+    Replica * this = (Replica *) malloc(sizeof(Replica));
+    CHECK(this != NULL)
+    this->id = nbReplicas++;
+    ReplicaMailboxInit(&this->mb);
+    return this;
+}
+
+static int replicaStart(void * replica) {
+    Replica * this = replica;
+    return pthread_create(&this->thread, NULL, &replicaRun, this);
+}
+
+static int replicaStop(void * replica) {
+    Replica * this = replica;
+    Msg msg = { .kind = M_STOP };
+    ReplicaMailboxSend(&this->mb, &msg); // After the pending events
+    return pthread_join(this->thread, NULL);
+}
+
+static int replicaFree(void * replica) {
+    Replica * this = replica;
+    ReplicaMailboxDestroy(&this->mb);
+    free(this);
+    return 0;
+}
+
+static long replicaPending(void * replica) {
+    return ReplicaMailboxGetCount(&((Replica *) replica)->mb);
+}
+
+static void replicaSync(void * replica) {
+    sem_t done;
+    sem_init(&done, 0, 0);
+    Msg msg = { .kind = M_SYNC, .done = &done };
+    ReplicaMailboxSend(&((Replica *) replica)->mb, &msg);
+    while (sem_wait(&done) == -1 && errno == EINTR) {
+    }
+    sem_destroy(&done);
+}
+
+static const ShardOps replicaOps = {
+    .create = &replicaNew,
+    .start = &replicaStart,
+    .stop = &replicaStop,
+    .destroy = &replicaFree,
+    .pending = &replicaPending,
+    .sync = &replicaSync
+};
+
+static void sendToEveryKey(Shard * shard, int seq) {
+    for (uint64_t key = 0; key < NB_KEYS; key++) {
+        Replica * replica = shardRoute(shard, key);
+        Msg msg = { .kind = M_EVENT, .key = key, .seq = seq };
+        ReplicaMailboxSend(&replica->mb, &msg);
+        shardRouteDone(shard);
+    }
+}
+
+static int routeOf(Shard * shard, uint64_t key) {
+    int id = ((Replica *) shardRoute(shard, key))->id;
+    shardRouteDone(shard);
+    return id;
+}
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    for (int key = 0; key < NB_KEYS; key++) {
+        lastSeq[key] = -1;
+    }
+
+    // Any depth is above the high watermark : each rebalance adds a replica
+    Shard * shard = shardNew(&replicaOps, MIN_REPLICAS, MAX_REPLICAS, -1, -1);
+    CHECK(shardGetCount(shard) == MIN_REPLICAS)
+
+    int before[NB_KEYS];
+    for (uint64_t key = 0; key < NB_KEYS; key++) {
+        before[key] = routeOf(shard, key);
+    }
+
+    // The shard grows while the replicas still have events of the moving keys
+    for (int seq = 0; seq < NB_SEQ; seq++) {
+        sendToEveryKey(shard, seq);
+    }
+    CHECK(shardRebalance(shard) == MAX_REPLICAS)
+    CHECK(shardRebalance(shard) == MAX_REPLICAS) // Already at the maximum
+    for (int seq = NB_SEQ; seq < 2 * NB_SEQ; seq++) {
+        sendToEveryKey(shard, seq);
+    }
+
+    // A key keeps its replica, or moves to the new one
+    int after[NB_KEYS];
+    int moved = 0;
+    for (uint64_t key = 0; key < NB_KEYS; key++) {
+        after[key] = routeOf(shard, key);
+        CHECK(after[key] == before[key] || after[key] == MAX_REPLICAS - 1)
+        moved += (after[key] != before[key]);
+    }
+    CHECK(moved > 0 && moved < NB_KEYS)
+
+    // Every event has been handled, in the order of its key, by the replica of its key
+    shardFree(shard);
+    CHECK(disorders == 0)
+    for (uint64_t key = 0; key < NB_KEYS; key++) {
+        CHECK(lastSeq[key] == 2 * NB_SEQ - 1)
+        CHECK(handledBy[key] == after[key])
+    }
+
+    // The autoscale thread is stopped before the replicas are freed
+    nbReplicas = 0;
+    shard = shardNew(&replicaOps, 1, MAX_REPLICAS, -1, -1);
+    shardAutoscale(shard, 1);
+    usleep(10000);
+    shardFree(shard);
+
+    return EXIT_SUCCESS;
+}
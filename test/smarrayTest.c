@@ -0,0 +1,82 @@
+/**
+ * @file smarrayTest.c
+ *
+ * @brief Test of the state machine array library, with a population of switches
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <smarray.h>
+
+#include "test.h"
+
+
+#define SIZE 1000
+
+typedef enum { S_FORGET = 0, S_OFF, S_ON, NB_STATE } STATE;
+typedef enum { E_NOP = 0, E_TOGGLE, NB_EVENT } EVENT;
+typedef enum { A_NOP = 0, A_SWITCH_ON, NB_ACTION } ACTION;
+
+static const SmArrayTransition switches[NB_STATE][NB_EVENT] = {
+    [S_OFF][E_TOGGLE] = { S_ON, A_SWITCH_ON },
+    [S_ON][E_TOGGLE] = { S_OFF, A_NOP }
+};
+
+static uint32_t switchedOn = 0;
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void actionSwitchOn(void * caller, const uint32_t * indices, uint32_t count) {
+    (void) caller;
+    for (uint32_t k = 0; k < count; k++) {
+        CHECK(indices[k] < SIZE)
+    }
+    switchedOn += count;
+}
+
+static const SmArrayAction actions[NB_ACTION] = {
+    [A_SWITCH_ON] = &actionSwitchOn
+};
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    SmArray * population = smArrayNew(SIZE, NB_STATE, NB_EVENT, &switches[0][0], NB_ACTION, actions, S_OFF, NULL);
+    CHECK(population != NULL)
+
+    // Few events : only the posted instances are stepped
+    CHECK(smArrayPost(population, 3, E_TOGGLE) == 0)
+    CHECK(smArrayPost(population, 3, E_TOGGLE) == -1) // Already pending
+    CHECK(smArrayStep(population) == 1)
+    CHECK(smArrayGetState(population, 3) == S_ON)
+    CHECK(smArrayGetState(population, 4) == S_OFF)
+    CHECK(switchedOn == 1)
+
+    // Every instance : the whole population is stepped
+    for (uint32_t i = 0; i < SIZE; i++) {
+        CHECK(smArrayPost(population, i, E_TOGGLE) == 0)
+    }
+    CHECK(smArrayStep(population) == SIZE)
+    CHECK(smArrayGetState(population, 3) == S_OFF)
+    CHECK(smArrayGetState(population, 4) == S_ON)
+    CHECK(switchedOn == SIZE)
+
+    // Out of range
+    CHECK(smArrayPost(population, SIZE, E_TOGGLE) == -1)
+    CHECK(smArrayPost(population, 0, NB_EVENT) == -1)
+    smArrayFree(population);
+
+    // A transition to an unknown ACTION is refused
+    SmArrayTransition wrong[NB_STATE][NB_EVENT] = {
+        [S_OFF][E_TOGGLE] = { S_ON, NB_ACTION }
+    };
+    CHECK(smArrayNew(SIZE, NB_STATE, NB_EVENT, &wrong[0][0], NB_ACTION, actions, S_OFF, NULL) == NULL)
+    CHECK(smArrayNew(SIZE, NB_STATE, NB_EVENT, &switches[0][0], NB_ACTION, actions, NB_STATE, NULL) == NULL)
+
+    return EXIT_SUCCESS;
+}
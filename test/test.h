@@ -0,0 +1,36 @@
+/**
+ * @file test.h
+ *
+ * @brief Checks used by the tests of the libraries
+ *
+ * A test is a program that returns EXIT_FAILURE as soon as a check fails.
+ * The checks do not depend on assert(), which NDEBUG disables.
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/**
+ * @def CHECK
+ *
+ * Stops the test if the condition is false
+ */
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed : %s\n", __FILE__, __LINE__, #condition); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0);
+
+
+#endif //TEST_H
@@ -0,0 +1,80 @@
+/**
+ * @file typedmailboxTest.c
+ *
+ * @brief Test of the mailbox specialized to one message type, with two producers
+ *
+ * @date April 2020
+ *
+ * @authors Clément PUYBAREAU, Louis FROGER
+ *
+ * @copyright CCBY 4.0
+ */
+
+#include <pthread.h>
+#include <typedmailbox.h>
+
+#include "test.h"
+
+
+#define CAPACITY 4
+#define NB_PRODUCERS 2
+#define NB_SENT 10000
+
+typedef struct {
+    int producer;
+    int seq;
+} Msg;
+
+MAILBOX_DECL(Test, Msg, CAPACITY)
+
+static TestMailbox mailbox;
+
+/*----------------------- STATIC FUNCTIONS -----------------------*/
+
+static void * produce(void * arg) {
+    Msg msg = { .producer = (int) (intptr_t) arg };
+    for (msg.seq = 0; msg.seq < NB_SENT; msg.seq++) {
+        TestMailboxSend(&mailbox, &msg); // Blocks while the consumer is behind
+    }
+    return NULL;
+}
+
+
+/*----------------------- MAIN -----------------------*/
+
+int main() {
+    TestMailboxInit(&mailbox);
+
+    // Full and empty mailbox, in one thread
+    Msg msg = { 0, 0 };
+    for (msg.seq = 0; msg.seq < CAPACITY; msg.seq++) {
+        CHECK(TestMailboxTrySend(&mailbox, &msg) == 0)
+    }
+    CHECK(TestMailboxTrySend(&mailbox, &msg) == -1)
+    CHECK(TestMailboxGetCount(&mailbox) == CAPACITY)
+    for (int i = 0; i < CAPACITY; i++) {
+        CHECK(TestMailboxTryReceive(&mailbox, &msg) == 0)
+        CHECK(msg.seq == i)
+    }
+    CHECK(TestMailboxTryReceive(&mailbox, &msg) == -1)
+
+    // Several producers : the messages of each one arrive in their order
+    pthread_t producers[NB_PRODUCERS];
+    for (int p = 0; p < NB_PRODUCERS; p++) {
+        CHECK(pthread_create(&producers[p], NULL, &produce, (void *) (intptr_t) p) == 0)
+    }
+    int next[NB_PRODUCERS] = { 0 };
+    for (int i = 0; i < NB_PRODUCERS * NB_SENT; i++) {
+        TestMailboxReceive(&mailbox, &msg);
+        CHECK(msg.producer >= 0 && msg.producer < NB_PRODUCERS)
+        CHECK(msg.seq == next[msg.producer])
+        next[msg.producer]++;
+    }
+    for (int p = 0; p < NB_PRODUCERS; p++) {
+        pthread_join(producers[p], NULL);
+    }
+    CHECK(TestMailboxGetCount(&mailbox) == 0)
+
+    TestMailboxDestroy(&mailbox);
+    return EXIT_SUCCESS;
+}